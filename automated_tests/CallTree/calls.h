@@ -0,0 +1,5 @@
+#pragma once
+
+void leaf();
+void middle();
+void top();
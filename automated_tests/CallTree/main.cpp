@@ -0,0 +1,17 @@
+#include "calls.h"
+
+void leaf() {}
+
+void middle() {
+    leaf();
+}
+
+void top() {
+    middle();
+    leaf();
+}
+
+int main() {
+    top();
+    return 0;
+}
@@ -0,0 +1,5 @@
+#include "base.h"
+
+class Derived : public Base {};
+
+class MoreDerived : public Derived {};
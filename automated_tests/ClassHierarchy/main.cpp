@@ -0,0 +1,5 @@
+#include "base.h"
+
+class Other : public Base {};
+
+int main() { return 0; }
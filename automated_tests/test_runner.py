@@ -11,7 +11,7 @@ import os
 import sys
 import json
 import subprocess as sp
-from hamcrest import assert_that, has_length, has_item
+from hamcrest import assert_that, equal_to, has_length, has_item
 
 sys.dont_write_bytecode = True
 os.environ["PYTHONDONTWRITEBYTECODE"] = "1"
@@ -30,6 +30,21 @@ def read_locations(project_dir, lines):
     return [Location(os.path.join(project_dir, line[0]), line[1], line[2]) for line in lines]
 
 
+def read_tree(project_dir, lines):
+    """Section titles are kept as is, "<indent>name\tlocation[\tcontext]"
+    lines become "<indent>location"."""
+    ret = []
+    for line in (line for line in lines.split("\n") if len(line) > 0):
+        columns = line.split("\t")
+        if len(columns) == 1:
+            ret.append(line)
+        else:
+            indent = len(columns[0]) - len(columns[0].lstrip(" "))
+            location = Location.from_str(os.path.join(project_dir, columns[1]))
+            ret.append("%s%r" % (" " * indent, location))
+    return ret
+
+
 class Location:
     def __init__(self, file, line, col):
         self.file, self.line, self.col = str(file), int(line), int(col)
@@ -76,6 +91,16 @@ def run(rdm, project_dir, test_dir, test_files, rc_command, expected_locations):
         expected_location = Location.from_str(expected_location_string.format(test_dir))
         assert_that(actual_locations, has_item(expected_location))
 
+
+def run_tree(rdm, project_dir, test_dir, test_files, rc_command, expected_lines):
+    print 'running tree test'
+    actual_lines = \
+        read_tree(project_dir,
+                  run_rc([c.format(test_dir) for c in rc_command]))
+    expected_lines = [line.format(test_dir) for line in expected_lines]
+    # Siblings aren't ordered, the indentation still tells the levels apart
+    assert_that(sorted(actual_lines), equal_to(sorted(expected_lines)))
+
 def setup_rdm(test_dir, test_files):
     rdm = sp.Popen(["rdm", "-n", socket_file, "-d", "~/.rtags_dev", "-o", "-B", "-C", "--log-flush" ],
                    stdout=sp.PIPE, stderr=sp.STDOUT)
@@ -99,6 +124,9 @@ def test_generator():
         rdm = setup_rdm(test_dir, test_files)
         for e in expectations:
             test_generator.__name__ = os.path.basename(test_dir)
-            yield run, rdm, project_dir, test_dir, test_files, e["rc-command"], e["expectation"]
+            if "tree-expectation" in e:
+                yield run_tree, rdm, project_dir, test_dir, test_files, e["rc-command"], e["tree-expectation"]
+            else:
+                yield run, rdm, project_dir, test_dir, test_files, e["rc-command"], e["expectation"]
         rdm.terminate()
         rdm.wait()
@@ -0,0 +1,144 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BloomFilter_h
+#define BloomFilter_h
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "GenerationLRUCache.h"
+#include "rct/Serializer.h"
+#include "rct/String.h"
+
+// Probabilistic set of keys. contains() never returns false for a key that
+// was inserted. A null filter contains everything.
+struct BloomFilter
+{
+    BloomFilter()
+        : hashCount(0)
+    {}
+    BloomFilter(size_t count, size_t bitsPerKey = 10)
+        : hashCount(std::max<uint32_t>(1, static_cast<uint32_t>(bitsPerKey * 69 / 100))) // ln(2)
+    {
+        const size_t bytes = (std::max<size_t>(64, count * bitsPerKey) + 7) / 8;
+        bits.resize(bytes);
+        memset(bits.data(), 0, bytes);
+    }
+
+    uint32_t hashCount;
+    String bits;
+
+    bool isNull() const { return bits.isEmpty(); }
+
+    void insert(const char *data, size_t size)
+    {
+        assert(!isNull());
+        uint32_t h1, h2;
+        hash(data, size, h1, h2);
+        const uint32_t bitCount = bits.size() * 8;
+        for (uint32_t i=0; i<hashCount; ++i) {
+            const uint32_t bit = (h1 + (i * h2)) % bitCount;
+            bits[bit / 8] |= (1 << (bit % 8));
+        }
+    }
+    void insert(const String &str) { insert(str.constData(), str.size()); }
+
+    bool contains(const char *data, size_t size) const
+    {
+        if (isNull())
+            return true;
+        uint32_t h1, h2;
+        hash(data, size, h1, h2);
+        const uint32_t bitCount = bits.size() * 8;
+        for (uint32_t i=0; i<hashCount; ++i) {
+            const uint32_t bit = (h1 + (i * h2)) % bitCount;
+            if (!(bits.at(bit / 8) & (1 << (bit % 8))))
+                return false;
+        }
+        return true;
+    }
+    bool contains(const String &str) const { return contains(str.constData(), str.size()); }
+
+private:
+    // 64-bit FNV-1a split in two for double hashing
+    static void hash(const char *data, size_t size, uint32_t &h1, uint32_t &h2)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i=0; i<size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 1099511628211ull;
+        }
+        h1 = static_cast<uint32_t>(h);
+        h2 = static_cast<uint32_t>(h >> 32) | 1;
+    }
+};
+
+template <> inline Serializer &operator<<(Serializer &s, const BloomFilter &t)
+{
+    s << t.hashCount << t.bits;
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, BloomFilter &t)
+{
+    s >> t.hashCount >> t.bits;
+    return s;
+}
+
+// A file's targets and usrs filters
+struct BloomFilters {
+    BloomFilter targets, usrs;
+
+    size_t size() const { return sizeof(BloomFilters) + targets.bits.size() + usrs.bits.size(); }
+};
+
+// Least recently used filters are dropped once their bytes exceed the
+// budget. Shared between a project and its snapshots. Thread safe.
+class BloomFilterCache : public GenerationLRUCache<uint32_t, const BloomFilters>
+{
+public:
+    typedef GenerationLRUCache<uint32_t, const BloomFilters> Base;
+    typedef BloomFilters Filters;
+
+    BloomFilterCache(size_t maxBytes)
+        : Base(maxBytes), mProbeHits(0), mProbeSkips(0)
+    {}
+
+    struct Stats : public Base::Stats {
+        Stats()
+            : probeHits(0), probeSkips(0)
+        {}
+        size_t probeHits, probeSkips;
+    };
+
+    void recordProbe(bool hit) { ++(hit ? mProbeHits : mProbeSkips); }
+
+    Stats stats() const
+    {
+        Stats ret;
+        static_cast<Base::Stats &>(ret) = Base::stats();
+        ret.probeHits = mProbeHits;
+        ret.probeSkips = mProbeSkips;
+        return ret;
+    }
+private:
+    std::atomic<size_t> mProbeHits, mProbeSkips;
+};
+
+#endif
@@ -0,0 +1,80 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "CallTreeJob.h"
+
+#include "Project.h"
+
+CallTreeJob::CallTreeJob(Location loc,
+                         const std::shared_ptr<QueryMessage> &query,
+                         const std::shared_ptr<Project> &project)
+    : QueryJob(query, project), location(loc)
+{
+}
+
+Symbol CallTreeJob::resolve(const String &usr, uint32_t fileId)
+{
+    auto it = mResolved.find(usr);
+    if (it != mResolved.end())
+        return it->second;
+    Symbol ret;
+    for (const Symbol &sym : project()->findByUsr(usr, fileId, Project::All)) {
+        if (!RTags::isFunction(sym.kind))
+            continue;
+        if (ret.isNull() || (sym.isDefinition() && !ret.isDefinition()))
+            ret = sym;
+    }
+    if (ret.isNull())
+        ret.usr = usr;
+    mResolved[usr] = ret;
+    return ret;
+}
+
+int CallTreeJob::execute()
+{
+    Symbol symbol = project()->findSymbol(location);
+    if (symbol.isNull())
+        return 1;
+    if (!RTags::isFunction(symbol.kind) || symbol.isReference())
+        symbol = project()->findTarget(symbol);
+    if (symbol.isNull() || !RTags::isFunction(symbol.kind) || symbol.usr.isEmpty())
+        return 1;
+
+    const bool callees = queryFlags() & QueryMessage::Callees;
+    const FileMapType type = callees ? Callees : Callers;
+    const int depth = std::max(1, queryMessage()->callDepth());
+
+    // usrs on the current path, a recursive call is printed but not expanded
+    Set<String> path;
+    std::function<bool(const Symbol &, int)> recurse = [&](const Symbol &sym, int level) {
+        const String name = sym.symbolName.isEmpty() ? sym.usr : sym.symbolName;
+        const String loc = sym.location.isNull() ? String() : sym.location.toString(locationToStringFlags(), 0, project().get());
+        if (!write<1024>("%s%s\t%s", String(level * 2 + 2, ' ').constData(), name.constData(), loc.constData()))
+            return false;
+        if (level == depth || !path.insert(sym.usr))
+            return true;
+        const uint32_t fileId = sym.location.isNull() ? location.fileId() : sym.location.fileId();
+        for (const String &usr : project()->findCallGraphEdges(type, sym.usr)) {
+            if (isAborted() || !recurse(resolve(usr, fileId), level + 1))
+                return false;
+        }
+        path.remove(sym.usr);
+        return true;
+    };
+
+    if (!write(callees ? "Callees:" : "Callers:"))
+        return 1;
+    return recurse(symbol, 0) ? 0 : 1;
+}
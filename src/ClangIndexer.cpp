@@ -16,11 +16,13 @@
 #define RTAGS_SINGLE_THREAD
 #include "ClangIndexer.h"
 
+#include <sys/resource.h>
 #include <unistd.h>
 #if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 25)
 #include <clang-c/Documentation.h>
 #endif
 
+#include "BloomFilter.h"
 #include "Diagnostic.h"
 #include "FileMap.h"
 #include "QueryMessage.h"
@@ -34,6 +36,18 @@
 #include "VisitFileResponseMessage.h"
 #include "Location.h"
 
+// One CXIndex for the whole process, a persistent rp reuses it for every
+// job instead of setting one up per translation unit
+static CXIndex sharedIndex()
+{
+    static struct Index {
+        Index() : index(clang_createIndex(0, 1)) {}
+        ~Index() { clang_disposeIndex(index); }
+        CXIndex index;
+    } index;
+    return index.index;
+}
+
 static inline String usr(const CXCursor &cursor)
 {
     return RTags::eatString(clang_getCursorUSR(clang_getCanonicalCursor(cursor)));
@@ -78,10 +92,10 @@ Flags<Server::Option> ClangIndexer::sServerOpts;
 Path ClangIndexer::sServerSandboxRoot;
 ClangIndexer::ClangIndexer()
     : mCurrentTranslationUnit(String::npos), mLastCursor(clang_getNullCursor()),
-      mLastCallExprSymbol(0), mVisitFileResponseMessageFileId(0),
-      mVisitFileResponseMessageVisit(0), mParseDuration(0), mVisitDuration(0), mBlocked(0),
+      mLastCallExprSymbol(0), mParseDuration(0), mVisitDuration(0), mBlocked(0),
       mAllowed(0), mIndexed(1), mVisitFileTimeout(0), mIndexDataMessageTimeout(0),
-      mFileIdsQueried(0), mFileIdsQueriedTime(0), mCursorsVisited(0), mLogFile(0),
+      mFileIdsQueried(0), mFileIdsQueriedTime(0), mFileIdsBatched(0), mFileIdBatches(0), mFileIdsBatchedTime(0),
+      mCursorsVisited(0), mUnchangedFiles(0), mLogFile(0),
       mConnection(Connection::create(RClient::NumOptions)), mUnionRecursion(false),
       mInTemplateFunction(0)
 {
@@ -154,9 +168,13 @@ bool ClangIndexer::exec(const String &data)
 
     const uint64_t parseTime = Rct::currentTimeMs();
 
+    // Every job carries the nice value. Persistent rp processes run several
+    // jobs so apply it relative to the priority we started with rather
+    // than with the cumulative nice(2).
+    static const int startPriority = getpriority(PRIO_PROCESS, 0);
     if (niceValue != INT_MIN) {
-        errno = 0;
-        if (nice(niceValue) == -1) {
+        const int priority = std::min(19, std::max(-20, startPriority + niceValue));
+        if (getpriority(PRIO_PROCESS, 0) != priority && setpriority(PRIO_PROCESS, 0, priority) == -1) {
             error() << "Failed to nice rp" << Rct::strerror();
         }
     }
@@ -210,7 +228,11 @@ bool ClangIndexer::exec(const String &data)
     assert(mConnection->isConnected());
     assert(mSources.front().fileId);
     mIndexDataMessage.files()[mSources.front().fileId] |= IndexDataMessage::Visited;
-    parse() && visit() && diagnose();
+    if (parse()) {
+        resolveInclusions();
+        visit() && diagnose();
+        hashVisitedFiles();
+    }
     String message = mSourceFile.toTilde();
     String err;
 
@@ -242,8 +264,13 @@ bool ClangIndexer::exec(const String &data)
     }
     if (hasUnit) {
         String queryData;
+        if (mFileIdsBatched)
+            queryData = String::format(", %d batched in %d messages %dms",
+                                       mFileIdsBatched, mFileIdBatches, mFileIdsBatchedTime);
         if (mFileIdsQueried)
-            queryData = String::format(", %d queried %dms", mFileIdsQueried, mFileIdsQueriedTime);
+            queryData += String::format(", %d queried %dms", mFileIdsQueried, mFileIdsQueriedTime);
+        if (mUnchangedFiles)
+            queryData += String::format(", %d unchanged", mUnchangedFiles);
         const char *format = "(%d syms, %d symNames, %d includes, %d of %d files, symbols: %d of %d, %d cursors, %zu bytes written%s%s) (%d/%d/%dms)";
         message += String::format<1024>(format, cursorCount, symbolNameCount,
                                         mIndexDataMessage.includes().size(), mIndexed,
@@ -280,13 +307,108 @@ bool ClangIndexer::exec(const String &data)
 void ClangIndexer::onMessage(const std::shared_ptr<Message> &msg, const std::shared_ptr<Connection> &/*conn*/)
 {
     assert(msg->messageId() == VisitFileResponseMessage::MessageId);
-    const std::shared_ptr<VisitFileResponseMessage> vm = std::static_pointer_cast<VisitFileResponseMessage>(msg);
-    mVisitFileResponseMessageVisit = vm->visit();
-    mVisitFileResponseMessageFileId = vm->fileId();
+    mVisitFileResponse = std::static_pointer_cast<VisitFileResponseMessage>(msg);
     assert(EventLoop::eventLoop());
     EventLoop::eventLoop()->quit();
 }
 
+bool ClangIndexer::queryVisitFiles(const List<Path> &files)
+{
+    VisitFileMessage msg(files, mProject, mSources.front().fileId);
+    mVisitFileResponse.reset();
+    mConnection->send(msg);
+    EventLoop::eventLoop()->exec(mVisitFileTimeout);
+    return mVisitFileResponse && mVisitFileResponse->fileIds().size() == files.size();
+}
+
+void ClangIndexer::addVisitFile(uint32_t id, const Path &resolved, const Path &sourceFile, bool visit)
+{
+    assert(id);
+    Flags<IndexDataMessage::FileFlag> &flags = mIndexDataMessage.files()[id];
+    if (visit) {
+        flags |= IndexDataMessage::Visited;
+        ++mIndexed;
+    }
+    // fprintf(mLogFile, "%s %s\n", file.second ? "WON" : "LOST", resolved.constData());
+
+    Location::set(resolved, id);
+    if (resolved != sourceFile)
+        Location::set(sourceFile, id);
+}
+
+// Lets rdm tell a file that was only touched from one that was modified.
+// Files modified after the parse started or parsed from unsaved buffers
+// are left out.
+void ClangIndexer::hashVisitedFiles()
+{
+    for (const auto &it : mIndexDataMessage.files()) {
+        if (!(it.second & IndexDataMessage::Visited))
+            continue;
+        const Path path = Location::path(it.first);
+        if (mUnsavedFiles.contains(path))
+            continue;
+        const uint64_t lastModified = path.lastModifiedMs();
+        if (!lastModified || lastModified >= mIndexDataMessage.parseTime())
+            continue;
+        const String contents = path.readAll();
+        if (path.lastModifiedMs() != lastModified)
+            continue;
+        IndexDataMessage::FileHash &fileHash = mIndexDataMessage.fileHashes()[it.first];
+        fileHash.hash = RTags::contentHash(contents);
+        fileHash.lastModified = lastModified;
+    }
+}
+
+static void inclusionVisitor(CXFile includedFile, CXSourceLocation *, unsigned, CXClientData userData)
+{
+    Set<Path> &files = *static_cast<Set<Path> *>(userData);
+    files.insert(RTags::eatString(clang_getFileName(includedFile)));
+}
+
+// Ask rdm about every file the translation units include in one go instead
+// of one VisitFileMessage per header from createLocation()
+void ClangIndexer::resolveInclusions()
+{
+    Set<Path> included;
+    for (const auto &unit : mTranslationUnits) {
+        if (unit->unit)
+            clang_getInclusions(unit->unit, inclusionVisitor, &included);
+    }
+
+    List<Path> files, sourceFiles;
+    Set<Path> seen;
+    for (const Path &sourceFile : included) {
+        if (sourceFile.isEmpty() || sourceFile.startsWith('<') || Location::fileId(sourceFile))
+            continue;
+        bool ok;
+        const Path resolved = sourceFile.resolved(Path::RealPath, Path(), &ok);
+        if (!ok) // createLocation() will give it a few more chances
+            continue;
+        if (const uint32_t id = Location::fileId(resolved)) {
+            Location::set(sourceFile, id);
+        } else if (seen.insert(resolved)) {
+            files.append(resolved);
+            sourceFiles.append(sourceFile);
+        }
+    }
+    if (files.isEmpty())
+        return;
+
+    StopWatch sw;
+    if (!queryVisitFiles(files)) {
+        error() << "Error getting fileIds for" << files.size() << "files" << sw.elapsed() << mVisitFileTimeout;
+        exit(1);
+    }
+    mFileIdsBatched += files.size();
+    ++mFileIdBatches;
+    mFileIdsBatchedTime += sw.elapsed();
+    const List<uint32_t> &ids = mVisitFileResponse->fileIds();
+    for (size_t i=0; i<files.size(); ++i) {
+        if (const uint32_t id = ids.at(i))
+            addVisitFile(id, files.at(i), sourceFiles.at(i), mVisitFileResponse->visit(id));
+    }
+}
+
 Location ClangIndexer::createLocation(const Path &sourceFile, unsigned int line, unsigned int col, bool *blockedPtr)
 {
     uint32_t id = Location::fileId(sourceFile);
@@ -336,42 +458,23 @@ Location ClangIndexer::createLocation(const Path &sourceFile, unsigned int line,
     }
 
     ++mFileIdsQueried;
-    VisitFileMessage msg(resolved, mProject, mSources.front().fileId);
-
-    mVisitFileResponseMessageFileId = UINT_MAX;
-    mVisitFileResponseMessageVisit = false;
-    mConnection->send(msg);
     StopWatch sw;
-    EventLoop::eventLoop()->exec(mVisitFileTimeout);
+    const bool ok = queryVisitFiles(List<Path>() << resolved);
     const int elapsed = sw.elapsed();
     mFileIdsQueriedTime += elapsed;
-    switch (mVisitFileResponseMessageFileId) {
-    case 0:
-        return Location();
-    case UINT_MAX:
+    if (!ok) {
         // timed out.
-        if (mVisitFileResponseMessageFileId == UINT_MAX) {
-            error() << "Error getting fileId for" << resolved << mLastCursor
-                    << elapsed << mVisitFileTimeout;
-        }
+        error() << "Error getting fileId for" << resolved << mLastCursor
+                << elapsed << mVisitFileTimeout;
         exit(1);
-    default:
-        id = mVisitFileResponseMessageFileId;
-        break;
-    }
-    assert(id);
-    Flags<IndexDataMessage::FileFlag> &flags = mIndexDataMessage.files()[id];
-    if (mVisitFileResponseMessageVisit) {
-        flags |= IndexDataMessage::Visited;
-        ++mIndexed;
     }
-    // fprintf(mLogFile, "%s %s\n", file.second ? "WON" : "LOST", resolved.constData());
-
-    Location::set(resolved, id);
-    if (resolved != sourceFile)
-        Location::set(sourceFile, id);
+    id = mVisitFileResponse->fileIds().front();
+    if (!id)
+        return Location();
+    const bool visit = mVisitFileResponse->visit(id);
+    addVisitFile(id, resolved, sourceFile, visit);
 
-    if (blockedPtr && !mVisitFileResponseMessageVisit) {
+    if (blockedPtr && !visit) {
         *blockedPtr = true;
     }
     return Location(id, line, col);
@@ -909,6 +1012,24 @@ bool ClangIndexer::superclassTemplateMemberFunctionUgleHack(const CXCursor &curs
     return false;
 }
 
+void ClangIndexer::addCallEdge(Location location, const String &callee)
+{
+    for (int i=mScopeStack.size() - 1; i>=0; --i) {
+        const auto &scope = mScopeStack.at(i);
+        if (scope.type == Scope::FunctionDefinition) {
+            assert(scope.symbol);
+            if (!scope.symbol->usr.isEmpty()) {
+                std::shared_ptr<Unit> &u = unit(location);
+                u->callees[scope.symbol->usr].insert(callee);
+                u->callers[callee].insert(scope.symbol->usr);
+            }
+            break;
+        } else if (scope.type == Scope::FunctionDeclaration) {
+            break;
+        }
+    }
+}
+
 bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Location location, CXCursor ref, Symbol **cursorPtr)
 {
     if (cursorPtr)
@@ -1138,6 +1259,8 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
     setType(*c, clang_getCursorType(kind == CXCursor_MemberRefExpr ? ref : cursor));
     if (RTags::isFunction(refKind)) {
         mLastCallExprSymbol = c;
+        if (kind == CXCursor_CallExpr || kind == CXCursor_DeclRefExpr || kind == CXCursor_MemberRefExpr)
+            addCallEdge(location, refUsr);
     }
 
     if (mInTemplateFunction && !mParents.isEmpty()) {
@@ -1884,7 +2007,7 @@ bool ClangIndexer::parse()
         if (usedPch)
             mIndexDataMessage.setFlag(IndexDataMessage::UsedPCH);
 
-        auto unit = RTags::TranslationUnit::create(mSourceFile, args, &unsavedFiles[0], unsavedIndex, flags);
+        auto unit = RTags::TranslationUnit::create(mSourceFile, args, &unsavedFiles[0], unsavedIndex, flags, true, sharedIndex());
         mTranslationUnits.push_back(unit);
 
         warning() << "CI::parse loading unit:" << unit->clangLine << " " << (unit->unit != 0);
@@ -1940,6 +2063,47 @@ static inline void encodeSymbols(Map<Location, Symbol> &symbols)
     }
 }
 
+static inline void encodeCallEdges(Map<String, Set<String> > &edges)
+{
+    assert(Sandbox::hasRoot());
+    Map<String, Set<String> > encoded;
+    for (const auto &edge : edges) {
+        Set<String> &usrs = encoded[Sandbox::encoded(edge.first)];
+        for (const String &usr : edge.second)
+            usrs.insert(Sandbox::encoded(usr));
+    }
+    edges = std::move(encoded);
+}
+
+static size_t writeBloomFilters(const Path &path,
+                                const Map<String, Set<Location> > &targets,
+                                const Map<String, Set<Location> > &usrs)
+{
+    BloomFilter targetsFilter(targets.size()), usrsFilter(usrs.size());
+    for (const auto &target : targets)
+        targetsFilter.insert(target.first);
+    for (const auto &usr : usrs)
+        usrsFilter.insert(usr.first);
+
+    String data;
+    {
+        Serializer serializer(data);
+        serializer << targetsFilter << usrsFilter;
+    }
+    // rdm may be reading the old file, write a new one and rename it over
+    const Path tmp = path + ".tmp";
+    FILE *f = fopen(tmp.constData(), "w");
+    if (!f)
+        return 0;
+    bool ok = fwrite(data.constData(), data.size(), 1, f);
+    ok = !fclose(f) && ok;
+    if (!ok || ::rename(tmp.constData(), path.constData())) {
+        Path::rm(tmp);
+        return 0;
+    }
+    return data.size();
+}
+
 bool ClangIndexer::writeFiles(const Path &root, String &error)
 {
     size_t bytesWritten = 0;
@@ -1981,47 +2145,48 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         //           << unit->second->targets.size()
         //           << unit->second->usrs.size()
         //           << unit->second->symbolNames.size();
-        uint32_t fileMapOpts = 0;
-        if (ClangIndexer::serverOpts() & Server::NoFileLock)
-            fileMapOpts |= FileMap<int, int>::NoLock;
-
         if (hasRoot) {
             encodeSymbols(unit->second->symbols);
             Sandbox::encode(unit->second->usrs);
             Sandbox::encode(unit->second->symbolNames);
-        }
+            encodeCallEdges(unit->second->callees);
+            encodeCallEdges(unit->second->callers);
+        }
+
+        const Map<String, Set<Location> > targets = convertTargets(unit->second->targets, hasRoot);
+        Map<String, Set<Location> > subclasses;
+        for (const auto &sym : unit->second->symbols) {
+            for (const String &base : sym.second.baseClasses)
+                subclasses[base].insert(sym.first);
+        }
+        const uint32_t keyOpts = FileMap<String, Set<Location> >::PrefixIndex;
+        FileMapContainer::Writer writer;
+        writer.add(Symbols, FileMap<Location, Symbol>::encode(unit->second->symbols));
+        writer.add(Targets, FileMap<String, Set<Location> >::encode(targets, keyOpts));
+        writer.add(Usrs, FileMap<String, Set<Location> >::encode(unit->second->usrs, keyOpts));
+        writer.add(SymbolNames, FileMap<String, Set<Location> >::encode(unit->second->symbolNames, keyOpts));
+        writer.add(Tokens, FileMap<uint32_t, Token>::encode(unit->second->tokens));
+        writer.add(Subclasses, FileMap<String, Set<Location> >::encode(subclasses, keyOpts));
+        writer.add(Callees, FileMap<String, Set<String> >::encode(unit->second->callees, keyOpts));
+        writer.add(Callers, FileMap<String, Set<String> >::encode(unit->second->callers, keyOpts));
 
         size_t w;
-        // for (const char *name : { "/symbols", "/targets", "/usrs", "/symnames", "/tokens" }) {
-        //     if (Path::exists(unitRoot + "/symbols"))
-        //         ::error() << (unitRoot + name) << "already exists";
-        // }
-        if (!(w = FileMap<Location, Symbol>::write(unitRoot + "/symbols", unit->second->symbols, fileMapOpts))) {
-            error = "Failed to write symbols";
+        bool unchanged;
+        if (!(w = writer.write(unitRoot + "/" + FileMapContainer::fileName(), &unchanged))) {
+            error = "Failed to write filemaps";
             return false;
         }
-        bytesWritten += w;
-
-        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/targets", convertTargets(unit->second->targets, hasRoot), fileMapOpts))) {
-            error = "Failed to write targets";
-            return false;
-        }
-        bytesWritten += w;
-
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/usrs", unit->second->usrs, fileMapOpts))) {
-            error = "Failed to write usrs";
-            return false;
-        }
-        bytesWritten += w;
-
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/symnames", unit->second->symbolNames, fileMapOpts))) {
-            error = "Failed to write symbolNames";
-            return false;
+        mIndexDataMessage.fileMapSizes()[unit->first] = w;
+        if (unchanged) {
+            // the bloom filters are built from the same data
+            mIndexDataMessage.files()[unit->first] |= IndexDataMessage::Unchanged;
+            ++mUnchangedFiles;
+            return true;
         }
         bytesWritten += w;
 
-        if (!(w += FileMap<uint32_t, Token>::write(unitRoot + "/tokens", unit->second->tokens, fileMapOpts))) {
-            error = "Failed to write symbolNames";
+        if (!(w = writeBloomFilters(unitRoot + "/bloom", targets, unit->second->usrs))) {
+            error = "Failed to write bloom filters";
             return false;
         }
         bytesWritten += w;
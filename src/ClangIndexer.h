@@ -29,6 +29,7 @@
 #include <unordered_set>
 
 struct Unit;
+class VisitFileResponseMessage;
 class ClangIndexer
 {
 public:
@@ -42,6 +43,10 @@ private:
     bool diagnose();
     bool visit();
     bool parse();
+    void resolveInclusions();
+    bool queryVisitFiles(const List<Path> &files);
+    void addVisitFile(uint32_t id, const Path &resolved, const Path &sourceFile, bool visit);
+    void hashVisitedFiles();
     void tokenize(CXFile file, uint32_t fileId, const Path &path);
     bool writeFiles(const Path &root, String &error);
 
@@ -111,6 +116,7 @@ private:
                          Location loc, CXCursor reference,
                          Symbol **cursorPtr = 0);
     void handleBaseClassSpecifier(const CXCursor &cursor);
+    void addCallEdge(Location location, const String &callee);
     void handleInclude(const CXCursor &cursor, CXCursorKind kind, Location location);
     void handleLiteral(const CXCursor &cursor, CXCursorKind kind, Location location);
     CXChildVisitResult handleStatement(const CXCursor &cursor, CXCursorKind kind, Location location);
@@ -138,6 +144,8 @@ private:
         Map<String, Set<Location> > usrs;
         Map<String, Set<Location> > symbolNames;
         Map<uint32_t, Token> tokens;
+        // caller usr -> callee usrs and the reverse, for calls made in this file
+        Map<String, Set<String> > callees, callers;
     };
 
     std::shared_ptr<Unit> &unit(uint32_t fileId)
@@ -178,13 +186,13 @@ private:
     CXCursor mLastCursor;
     Symbol *mLastCallExprSymbol;
     Location mLastClass;
-    uint32_t mVisitFileResponseMessageFileId;
-    bool mVisitFileResponseMessageVisit;
+    std::shared_ptr<VisitFileResponseMessage> mVisitFileResponse;
     Path mSocketFile;
     StopWatch mTimer;
     int mParseDuration, mVisitDuration, mBlocked, mAllowed,
         mIndexed, mVisitFileTimeout, mIndexDataMessageTimeout,
-        mFileIdsQueried, mFileIdsQueriedTime, mCursorsVisited;
+        mFileIdsQueried, mFileIdsQueriedTime, mFileIdsBatched, mFileIdBatches, mFileIdsBatchedTime,
+        mCursorsVisited, mUnchangedFiles;
     UnsavedFiles mUnsavedFiles;
     List<String> mDebugLocations;
     FILE *mLogFile;
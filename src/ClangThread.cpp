@@ -21,11 +21,17 @@
 #include "AST.h"
 #endif
 
-struct Dep : public DependencyNode
+struct Dep
 {
     Dep(uint32_t f)
-        : DependencyNode(f)
+        : fileId(f)
     {}
+    void include(Dep *dependee)
+    {
+        includes[dependee->fileId] = dependee;
+    }
+    uint32_t fileId;
+    Hash<uint32_t, Dep*> includes;
     Hash<uint32_t, Map<Location, Location> > references;
 };
 
@@ -258,7 +264,7 @@ static bool validateHasInclude(uint32_t ref, const Dep *cur, Set<uint32_t> &seen
     if (!seen.insert(ref))
         return false;
     for (const auto &pair : cur->includes) {
-        if (validateHasInclude(ref, static_cast<const Dep*>(pair.second), seen))
+        if (validateHasInclude(ref, pair.second, seen))
             return true;
     }
     return false;
@@ -276,7 +282,7 @@ static bool validateNeedsInclude(const Dep *source, const Dep *header, Set<uint3
     }
     for (const auto &child : header->includes) {
         // error() << "Checking child" << Location::path(child.second->fileId);
-        if (validateNeedsInclude(source, static_cast<const Dep*>(child.second), seen)) {
+        if (validateNeedsInclude(source, child.second, seen)) {
             return true;
         }
     }
@@ -294,7 +300,7 @@ void ClangThread::checkIncludes()
 
         for (const auto &dep  : it.second->includes) {
             Set<uint32_t> seen;
-            if (!validateNeedsInclude(it.second, static_cast<Dep*>(dep.second), seen)) {
+            if (!validateNeedsInclude(it.second, dep.second, seen)) {
                 writeToConnetion(String::format<128>("%s includes %s for no reason",
                                                      path.constData(),
                                                      Location::path(dep.second->fileId).constData()));
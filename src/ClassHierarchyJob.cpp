@@ -51,12 +51,12 @@ int ClassHierarchyJob::execute()
             indent = 2;
             write<256>("  %s\t%s",
                        sym.symbolName.constData(),
-                       sym.location.toString(locationToStringFlags()).constData());
+                       sym.location.toString(locationToStringFlags(), 0, project().get()).constData());
         } else {
             write<256>("%s%s\t%s",
                        String(indent, ' ').constData(),
                        sym.symbolName.constData(),
-                       sym.location.toString(locationToStringFlags()).constData());
+                       sym.location.toString(locationToStringFlags(), 0, project().get()).constData());
         }
         for (const Symbol &c : classes) {
             recurse(c, title, indent + 2, find);
@@ -177,18 +177,19 @@ void applyToSource(Source &source, Flags<CompilerManager::Flag> flags)
         debug() << "[CompilerManager] returning.\n";
     }
     if (flags & IncludeDefines)
-        source.defines << compiler.defines;
+        source.defines.mutate() << compiler.defines;
     if (flags & IncludeIncludePaths) {
-        if (!source.arguments.contains("-nostdinc")) {
-            source.includePaths << compiler.includePaths;
-            if (!source.arguments.contains("-nostdinc++"))
-                source.includePaths << compiler.stdincxxPaths;
-            if (!source.arguments.contains("-nobuiltininc"))
-                source.includePaths << compiler.builtinPaths;
+        if (!source.arguments->contains("-nostdinc")) {
+            List<Source::Include> &includePaths = source.includePaths.mutate();
+            includePaths << compiler.includePaths;
+            if (!source.arguments->contains("-nostdinc++"))
+                includePaths << compiler.stdincxxPaths;
+            if (!source.arguments->contains("-nobuiltininc"))
+                includePaths << compiler.builtinPaths;
         } else if (!strncmp("clang", cpath.fileName(), 5)) {
             // Module.map causes errors when -nostdinc is used, as it
             // can't find some mappings to compiler provided headers
-            source.arguments.append("-fno-modules");
+            source.arguments.mutate().append("-fno-modules");
         }
     }
 }
@@ -242,9 +242,9 @@ void CompletionThread::process(Request *request)
         flags |= CXTranslationUnit_CreatePreambleOnFirstParse;
 #endif
         for (const auto &inc : options.includePaths) {
-            request->source.includePaths << inc;
+            request->source.includePaths.mutate() << inc;
         }
-        request->source.defines << options.defines;
+        request->source.defines.mutate() << options.defines;
 
         cache->translationUnit = RTags::TranslationUnit::create(sourceFile,
                                                                 request->source.toCommandLine(Source::Default|Source::ExcludeDefaultArguments),
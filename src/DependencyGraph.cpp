@@ -0,0 +1,383 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "DependencyGraph.h"
+
+#include <algorithm>
+#include <iterator>
+
+DependencyGraph::DependencyGraph(const Rows &includes)
+    : mFileCount(0), mEdgeCount(0), mGeneration(0), mCachedEntries(0)
+{
+    build(includes);
+}
+
+static inline void removeValue(List<uint32_t> &list, uint32_t value)
+{
+    list.erase(std::remove(list.begin(), list.end(), value), list.end());
+}
+
+DependencyGraph::DependencyGraph(const DependencyGraph &previous, const Rows &includes, const Set<uint32_t> &removed)
+    : mBase(previous.mBase), mAddedIndexes(previous.mAddedIndexes), mAddedFileIds(previous.mAddedFileIds),
+      mRemoved(previous.mRemoved), mFileCount(previous.mFileCount), mEdgeCount(previous.mEdgeCount),
+      mGeneration(0), mCachedEntries(0)
+{
+    mPatched[Includes] = previous.mPatched[Includes];
+    mPatched[Dependents] = previous.mPatched[Dependents];
+
+    Set<uint32_t> touched; // indexes whose rows changed
+    auto patch = [this, &touched](uint32_t idx, Direction direction) -> List<uint32_t> & {
+        touched.insert(idx);
+        Hash<uint32_t, List<uint32_t> > &rows = mPatched[direction];
+        auto it = rows.find(idx);
+        if (it == rows.end())
+            it = rows.insert(std::make_pair(idx, row(idx, direction))).first;
+        return it->second;
+    };
+    auto insert = [this](uint32_t fileId) {
+        uint32_t idx = index(fileId);
+        if (idx == Invalid)
+            idx = addIndex(fileId);
+        if (mRemoved.remove(idx))
+            ++mFileCount;
+        return idx;
+    };
+
+    for (const auto &it : includes) {
+        const uint32_t idx = insert(it.first);
+        List<uint32_t> targets;
+        targets.reserve(it.second.size());
+        for (uint32_t fileId : it.second) {
+            const uint32_t target = insert(fileId);
+            if (target != idx)
+                targets.append(target);
+        }
+        std::sort(targets.begin(), targets.end());
+        targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+        List<uint32_t> old = row(idx, Includes);
+        std::sort(old.begin(), old.end());
+        List<uint32_t> gone, added;
+        std::set_difference(old.begin(), old.end(), targets.begin(), targets.end(), std::back_inserter(gone));
+        std::set_difference(targets.begin(), targets.end(), old.begin(), old.end(), std::back_inserter(added));
+        for (uint32_t target : gone)
+            removeValue(patch(target, Dependents), idx);
+        for (uint32_t target : added)
+            patch(target, Dependents).append(idx);
+        mEdgeCount += added.size();
+        mEdgeCount -= gone.size();
+        patch(idx, Includes) = std::move(targets);
+    }
+
+    for (uint32_t fileId : removed) {
+        const uint32_t idx = liveIndex(fileId);
+        if (idx == Invalid)
+            continue;
+        for (uint32_t target : row(idx, Includes))
+            removeValue(patch(target, Dependents), idx);
+        for (uint32_t dependent : row(idx, Dependents))
+            removeValue(patch(dependent, Includes), idx);
+        mEdgeCount -= rowSize(idx, Includes) + rowSize(idx, Dependents);
+        patch(idx, Includes).clear();
+        patch(idx, Dependents).clear();
+        mRemoved.insert(idx);
+        --mFileCount;
+    }
+
+    // Any edge that was added or removed has a touched file at both ends,
+    // so a closure that contains no touched file is still the same.
+    Set<uint32_t> changed;
+    for (uint32_t idx : touched)
+        changed.insert(fileIdAt(idx));
+    {
+        std::lock_guard<std::mutex> lock(previous.mMutex);
+        for (int direction = Includes; direction <= Dependents; ++direction) {
+            for (const auto &it : previous.mClosures[direction]) {
+                const List<uint32_t> &files = *it.second;
+                bool affected = false;
+                if (files.size() < changed.size()) {
+                    for (uint32_t file : files) {
+                        if (changed.contains(file)) {
+                            affected = true;
+                            break;
+                        }
+                    }
+                } else {
+                    for (uint32_t file : changed) {
+                        if (std::binary_search(files.begin(), files.end(), file)) {
+                            affected = true;
+                            break;
+                        }
+                    }
+                }
+                if (!affected) {
+                    mClosures[direction][it.first] = it.second;
+                    mCachedEntries += files.size();
+                }
+            }
+        }
+    }
+
+    if (mAddedFileIds.size() + mPatched[Includes].size() > std::max<size_t>(MinPatchedFiles, mFileCount / 8)) {
+        // too much has changed since the arrays were built, the closures
+        // are still right
+        build(rows());
+    }
+}
+
+void DependencyGraph::build(const Rows &includes)
+{
+    std::shared_ptr<Base> base = std::make_shared<Base>();
+    auto add = [&base](uint32_t fileId) {
+        uint32_t &idx = base->indexes[fileId];
+        if (!idx) {
+            base->fileIds.append(fileId);
+            idx = base->fileIds.size(); // 1 based until all are in
+        }
+    };
+    for (const auto &it : includes) {
+        add(it.first);
+        for (uint32_t fileId : it.second)
+            add(fileId);
+    }
+    for (auto &it : base->indexes)
+        --it.second;
+
+    const uint32_t count = base->fileIds.size();
+    Edges &forward = base->edges[Includes], &backward = base->edges[Dependents];
+    List<uint32_t> dependentCounts(count, 0);
+    forward.offsets.reserve(count + 1);
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        forward.offsets.append(forward.targets.size());
+        const auto it = includes.find(base->fileIds.at(idx));
+        if (it == includes.end())
+            continue;
+        const size_t start = forward.targets.size();
+        for (uint32_t fileId : it->second) {
+            const uint32_t target = base->indexes.value(fileId);
+            if (target != idx)
+                forward.targets.append(target);
+        }
+        std::sort(forward.targets.begin() + start, forward.targets.end());
+        forward.targets.erase(std::unique(forward.targets.begin() + start, forward.targets.end()), forward.targets.end());
+        for (size_t e = start; e < forward.targets.size(); ++e)
+            ++dependentCounts[forward.targets.at(e)];
+    }
+    forward.offsets.append(forward.targets.size());
+
+    backward.offsets.resize(count + 1, 0);
+    for (uint32_t idx = 0; idx < count; ++idx)
+        backward.offsets[idx + 1] = backward.offsets.at(idx) + dependentCounts.at(idx);
+    backward.targets.resize(forward.targets.size());
+    List<uint32_t> fill = backward.offsets;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        for (uint32_t e = forward.offsets.at(idx); e < forward.offsets.at(idx + 1); ++e)
+            backward.targets[fill[forward.targets.at(e)]++] = idx;
+    }
+
+    mBase = base;
+    mAddedIndexes.clear();
+    mAddedFileIds.clear();
+    mPatched[Includes].clear();
+    mPatched[Dependents].clear();
+    mRemoved.clear();
+    mFileCount = count;
+    mEdgeCount = forward.targets.size();
+}
+
+DependencyGraph::Rows DependencyGraph::rows() const
+{
+    Rows ret;
+    const size_t count = mBase->fileIds.size() + mAddedFileIds.size();
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        if (mRemoved.contains(idx))
+            continue;
+        List<uint32_t> &includes = ret[fileIdAt(idx)];
+        for (uint32_t target : row(idx, Includes))
+            includes.append(fileIdAt(target));
+    }
+    return ret;
+}
+
+List<uint32_t> DependencyGraph::row(uint32_t index, Direction direction) const
+{
+    const auto patched = mPatched[direction].find(index);
+    if (patched != mPatched[direction].end())
+        return patched->second;
+    if (index >= mBase->fileIds.size())
+        return List<uint32_t>();
+    const Edges &edges = mBase->edges[direction];
+    List<uint32_t> ret;
+    ret.assign(edges.targets.begin() + edges.offsets.at(index), edges.targets.begin() + edges.offsets.at(index + 1));
+    return ret;
+}
+
+List<uint32_t> DependencyGraph::edges(uint32_t fileId, Direction direction) const
+{
+    List<uint32_t> ret;
+    const uint32_t idx = liveIndex(fileId);
+    if (idx != Invalid) {
+        const List<uint32_t> indexes = row(idx, direction);
+        ret.reserve(indexes.size());
+        for (uint32_t target : indexes)
+            ret.append(fileIdAt(target));
+    }
+    return ret;
+}
+
+size_t DependencyGraph::edgeCount(uint32_t fileId, Direction direction) const
+{
+    const uint32_t idx = liveIndex(fileId);
+    return idx == Invalid ? 0 : rowSize(idx, direction);
+}
+
+uint32_t DependencyGraph::liveIndex(uint32_t fileId) const
+{
+    const uint32_t idx = index(fileId);
+    return idx == Invalid || mRemoved.contains(idx) ? Invalid : idx;
+}
+
+uint32_t DependencyGraph::index(uint32_t fileId) const
+{
+    const auto it = mBase->indexes.find(fileId);
+    if (it != mBase->indexes.end())
+        return it->second;
+    return mAddedIndexes.value(fileId, Invalid);
+}
+
+uint32_t DependencyGraph::fileIdAt(uint32_t index) const
+{
+    const size_t baseCount = mBase->fileIds.size();
+    return index < baseCount ? mBase->fileIds.at(index) : mAddedFileIds.at(index - baseCount);
+}
+
+size_t DependencyGraph::rowSize(uint32_t index, Direction direction) const
+{
+    const auto patched = mPatched[direction].find(index);
+    if (patched != mPatched[direction].end())
+        return patched->second.size();
+    if (index >= mBase->fileIds.size())
+        return 0;
+    const Edges &edges = mBase->edges[direction];
+    return edges.offsets.at(index + 1) - edges.offsets.at(index);
+}
+
+uint32_t DependencyGraph::addIndex(uint32_t fileId)
+{
+    const uint32_t ret = mBase->fileIds.size() + mAddedFileIds.size();
+    mAddedIndexes[fileId] = ret;
+    mAddedFileIds.append(fileId);
+    mRemoved.insert(ret); // not in the graph until its rows are set
+    return ret;
+}
+
+bool DependencyGraph::contains(uint32_t fileId) const
+{
+    return liveIndex(fileId) != Invalid;
+}
+
+List<uint32_t> DependencyGraph::fileIds() const
+{
+    List<uint32_t> ret;
+    ret.reserve(mFileCount);
+    const size_t count = mBase->fileIds.size() + mAddedFileIds.size();
+    for (size_t idx = 0; idx < count; ++idx) {
+        if (!mRemoved.contains(idx))
+            ret.append(fileIdAt(idx));
+    }
+    return ret;
+}
+
+std::shared_ptr<const List<uint32_t> > DependencyGraph::closure(uint32_t fileId, Direction direction) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Hash<uint32_t, std::shared_ptr<const List<uint32_t> > > &cache = mClosures[direction];
+    const auto cached = cache.find(fileId);
+    if (cached != cache.end())
+        return cached->second;
+
+    auto ret = std::make_shared<List<uint32_t> >();
+    const uint32_t start = index(fileId);
+    if (start == Invalid || mRemoved.contains(start)) {
+        ret->append(fileId);
+    } else {
+        const size_t count = mBase->fileIds.size() + mAddedFileIds.size();
+        if (mMarks.size() != count) {
+            mMarks.clear();
+            mMarks.resize(count, 0);
+            mGeneration = 0;
+        }
+        if (!++mGeneration) {
+            std::fill(mMarks.begin(), mMarks.end(), 0);
+            mGeneration = 1;
+        }
+        const Edges &edges = mBase->edges[direction];
+        const Hash<uint32_t, List<uint32_t> > &patched = mPatched[direction];
+        List<uint32_t> stack;
+        auto visit = [this, &stack](uint32_t next) {
+            if (mMarks.at(next) != mGeneration) {
+                mMarks[next] = mGeneration;
+                stack.append(next);
+            }
+        };
+        visit(start);
+        while (!stack.isEmpty()) {
+            const uint32_t current = stack.back();
+            stack.pop_back();
+            ret->append(fileIdAt(current));
+            const auto patch = patched.find(current);
+            if (patch != patched.end()) {
+                for (uint32_t next : patch->second)
+                    visit(next);
+            } else if (current < mBase->fileIds.size()) {
+                for (uint32_t e = edges.offsets.at(current); e < edges.offsets.at(current + 1); ++e)
+                    visit(edges.targets.at(e));
+            }
+        }
+        std::sort(ret->begin(), ret->end());
+    }
+
+    // the cache can use about as much memory as the graph itself
+    const size_t maxCachedEntries = std::max<size_t>(MinCachedEntries, mFileCount + (mEdgeCount * 2));
+    if (mCachedEntries + ret->size() > maxCachedEntries) {
+        mClosures[Includes].clear();
+        mClosures[Dependents].clear();
+        mCachedEntries = 0;
+    }
+    mCachedEntries += ret->size();
+    cache[fileId] = ret;
+    return ret;
+}
+
+bool DependencyGraph::reaches(uint32_t from, uint32_t to, Direction direction) const
+{
+    const std::shared_ptr<const List<uint32_t> > files = closure(from, direction);
+    return std::binary_search(files->begin(), files->end(), to);
+}
+
+size_t DependencyGraph::memoryUsage() const
+{
+    // the base arrays are shared with the graphs derived from this one
+    size_t ret = (mBase->fileIds.size() * 3 * sizeof(uint32_t)) + (mAddedFileIds.size() * 3 * sizeof(uint32_t));
+    for (const Edges &edges : mBase->edges)
+        ret += (edges.offsets.size() + edges.targets.size()) * sizeof(uint32_t);
+    for (const auto &patched : mPatched) {
+        for (const auto &it : patched)
+            ret += (it.second.size() + 2) * sizeof(uint32_t);
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    ret += (mCachedEntries + mMarks.size()) * sizeof(uint32_t);
+    return ret;
+}
@@ -0,0 +1,101 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef DependencyGraph_h
+#define DependencyGraph_h
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Set.h"
+
+// A project's include graph, the only place its edges are kept. Files get
+// dense indexes and their includes and dependents are ranges in flat
+// arrays (compressed sparse rows). A graph is never modified, a change
+// makes a new one that shares the arrays and replaces the rows of the
+// files it touched until enough has changed to rebuild them. Only closures
+// that contain a touched file are dropped. Transitive closures are
+// computed once per file and direction. Thread safe.
+class DependencyGraph
+{
+public:
+    typedef Hash<uint32_t, List<uint32_t> > Rows; // fileId -> included fileIds
+
+    // the files in includes and every file they include
+    DependencyGraph(const Rows &includes = Rows());
+    // previous with the includes of the files in includes replaced, then
+    // the files in removed taken out along with their edges
+    DependencyGraph(const DependencyGraph &previous, const Rows &includes, const Set<uint32_t> &removed);
+
+    enum Direction {
+        Includes,
+        Dependents
+    };
+
+    // the files fileId includes or is included by directly
+    List<uint32_t> edges(uint32_t fileId, Direction direction) const;
+    size_t edgeCount(uint32_t fileId, Direction direction) const;
+    // fileId and every file reachable from it, sorted
+    std::shared_ptr<const List<uint32_t> > closure(uint32_t fileId, Direction direction) const;
+    bool reaches(uint32_t from, uint32_t to, Direction direction) const;
+
+    bool contains(uint32_t fileId) const;
+    List<uint32_t> fileIds() const;
+    size_t fileCount() const { return mFileCount; }
+    size_t memoryUsage() const;
+private:
+    enum {
+        Invalid = 0xffffffff,
+        MinCachedEntries = 64 * 1024,
+        MinPatchedFiles = 1024
+    };
+
+    void build(const Rows &includes);
+    Rows rows() const;
+    uint32_t index(uint32_t fileId) const;
+    uint32_t liveIndex(uint32_t fileId) const;
+    uint32_t fileIdAt(uint32_t index) const;
+    uint32_t addIndex(uint32_t fileId);
+    size_t rowSize(uint32_t index, Direction direction) const;
+    List<uint32_t> row(uint32_t index, Direction direction) const;
+
+    struct Edges {
+        List<uint32_t> offsets, targets;
+    };
+    struct Base {
+        Hash<uint32_t, uint32_t> indexes;
+        List<uint32_t> fileIds;
+        Edges edges[2];
+    };
+    std::shared_ptr<const Base> mBase;
+    // files added since mBase was built have indexes after the base's
+    Hash<uint32_t, uint32_t> mAddedIndexes;
+    List<uint32_t> mAddedFileIds;
+    // rows that replace the base's, removed files have empty rows
+    Hash<uint32_t, List<uint32_t> > mPatched[2];
+    Set<uint32_t> mRemoved;
+    size_t mFileCount, mEdgeCount;
+
+    mutable std::mutex mMutex;
+    mutable Hash<uint32_t, std::shared_ptr<const List<uint32_t> > > mClosures[2];
+    mutable List<uint32_t> mMarks;
+    mutable uint32_t mGeneration;
+    mutable size_t mCachedEntries;
+};
+
+#endif
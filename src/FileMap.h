@@ -17,15 +17,23 @@
 #define FileMap_h
 
 #include <assert.h>
+#include <ctype.h>
 #include <fcntl.h>
+#include <strings.h>
 #include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <functional>
 #include <limits>
+#include <memory>
 
+#include "GenerationLRUCache.h"
 #include "Location.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
 #include "rct/Serializer.h"
+#include "rct/Set.h"
 
 template <typename T> inline static int compare(const T &l, const T &r)
 {
@@ -46,12 +54,185 @@ template <> inline int compare(const Location &l, const Location &r)
     return l.compare(r);
 }
 
+// Non-owning view of a String serialized in a FileMap. Only valid while the
+// FileMap it came from is alive.
+class StringView
+{
+public:
+    StringView()
+        : mData(0), mSize(0)
+    {}
+    explicit StringView(const char *pointer)
+    {
+        memcpy(&mSize, pointer, sizeof(mSize));
+        mData = pointer + sizeof(mSize);
+    }
+    StringView(const char *data, uint32_t size)
+        : mData(data), mSize(size)
+    {}
+
+    const char *data() const { return mData; }
+    uint32_t size() const { return mSize; }
+    bool isEmpty() const { return !mSize; }
+    char at(uint32_t idx) const { assert(idx < mSize); return mData[idx]; }
+    const char *begin() const { return mData; }
+    const char *end() const { return mData + mSize; }
+    String toString() const { return String(mData, mSize); }
+
+    int compare(const char *str, uint32_t size) const
+    {
+        const int cmp = memcmp(mData, str, std::min(mSize, size));
+        if (cmp)
+            return cmp;
+        if (mSize < size)
+            return -1;
+        return mSize > size ? 1 : 0;
+    }
+    int compare(const String &str) const { return compare(str.constData(), str.size()); }
+    bool operator==(const String &str) const { return !compare(str); }
+    bool operator!=(const String &str) const { return compare(str) != 0; }
+
+    bool startsWith(const String &str, String::CaseSensitivity cs = String::CaseSensitive) const
+    {
+        if (str.size() > mSize)
+            return false;
+        return !(cs == String::CaseSensitive
+                 ? memcmp(mData, str.constData(), str.size())
+                 : strncasecmp(mData, str.constData(), str.size()));
+    }
+
+    bool contains(const String &str, String::CaseSensitivity cs = String::CaseSensitive) const
+    {
+        if (str.size() > mSize)
+            return false;
+        const uint32_t last = mSize - str.size();
+        for (uint32_t i=0; i<=last; ++i) {
+            if (!(cs == String::CaseSensitive
+                  ? memcmp(mData + i, str.constData(), str.size())
+                  : strncasecmp(mData + i, str.constData(), str.size()))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int indexOf(char ch) const
+    {
+        const void *found = memchr(mData, ch, mSize);
+        return found ? static_cast<int>(static_cast<const char*>(found) - mData) : -1;
+    }
+
+    // same semantics as Rct::wildCmp but our data isn't null-terminated
+    bool wildCmp(const char *pattern, String::CaseSensitivity cs = String::CaseSensitive) const
+    {
+        const char *str = mData;
+        const char *const strEnd = mData + mSize;
+        const char *star = 0;
+        const char *starStr = 0;
+        auto equals = [cs](char l, char r) {
+            return cs == String::CaseSensitive ? l == r : tolower(l) == tolower(r);
+        };
+        while (str < strEnd) {
+            if (*pattern == '*') {
+                star = pattern++;
+                starStr = str;
+            } else if (*pattern && (*pattern == '?' || equals(*pattern, *str))) {
+                ++pattern;
+                ++str;
+            } else if (star) {
+                pattern = star + 1;
+                str = ++starStr;
+            } else {
+                return false;
+            }
+        }
+        while (*pattern == '*')
+            ++pattern;
+        return !*pattern;
+    }
+private:
+    const char *mData;
+    uint32_t mSize;
+};
+
+// Non-owning view of a Set<Location> serialized in a FileMap
+class LocationSpan
+{
+public:
+    LocationSpan()
+        : mData(0), mSize(0)
+    {}
+    explicit LocationSpan(const char *pointer)
+    {
+        memcpy(&mSize, pointer, sizeof(mSize));
+        mData = pointer + sizeof(mSize);
+    }
+
+    uint32_t size() const { return mSize; }
+    bool isEmpty() const { return !mSize; }
+    Location at(uint32_t idx) const
+    {
+        assert(idx < mSize);
+        Location loc;
+        memcpy(&loc, mData + (idx * sizeof(uint64_t)), sizeof(uint64_t));
+        return loc;
+    }
+    Location first() const { return at(0); }
+    bool contains(Location loc) const
+    {
+        // serialized from a Set so the locations are sorted
+        uint32_t lower = 0, upper = mSize;
+        while (lower < upper) {
+            const uint32_t mid = lower + ((upper - lower) / 2);
+            const Location l = at(mid);
+            if (l < loc) {
+                lower = mid + 1;
+            } else if (loc < l) {
+                upper = mid;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const LocationSpan *span, uint32_t idx)
+            : mSpan(span), mIndex(idx)
+        {}
+        Location operator*() const { return mSpan->at(mIndex); }
+        const_iterator &operator++() { ++mIndex; return *this; }
+        bool operator==(const const_iterator &other) const { return mIndex == other.mIndex; }
+        bool operator!=(const const_iterator &other) const { return mIndex != other.mIndex; }
+    private:
+        const LocationSpan *mSpan;
+        uint32_t mIndex;
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, mSize); }
+
+    Set<Location> toSet() const
+    {
+        Set<Location> ret;
+        for (uint32_t i=0; i<mSize; ++i)
+            ret.insert(ret.end(), at(i));
+        return ret;
+    }
+private:
+    const char *mData;
+    uint32_t mSize;
+};
+
+class FileMapContainer;
 template <typename Key, typename Value>
 class FileMap
 {
 public:
     FileMap()
-        : mPointer(0), mSize(0), mCount(0), mValuesOffset(0), mFD(-1), mOptions(0)
+        : mPointer(0), mSize(0), mCount(0), mValuesOffset(0), mFD(-1), mOptions(0),
+          mPrefixes(0), mBlocks(0)
     {}
 
     ~FileMap()
@@ -66,17 +247,32 @@ public:
         }
     }
 
+    // a FileMap living inside a FileMapContainer keeps the container mapped
+    void init(const char *pointer, uint32_t size, const std::shared_ptr<const FileMapContainer> &container)
+    {
+        mContainer = container;
+        init(pointer, size);
+    }
+
     void init(const char *pointer, uint32_t size)
     {
         mPointer = pointer;
         mSize = size;
         memcpy(&mCount, mPointer, sizeof(uint32_t));
         memcpy(&mValuesOffset, mPointer + sizeof(uint32_t), sizeof(uint32_t));
+        if (mCount & HasPrefixIndex) {
+            mCount &= ~static_cast<uint32_t>(HasPrefixIndex);
+            uint32_t offset;
+            memcpy(&offset, mPointer + mSize - sizeof(uint32_t), sizeof(offset));
+            mPrefixes = mPointer + offset;
+            mBlocks = mPrefixes + (mCount * sizeof(uint64_t));
+        }
     }
 
     enum Options {
         None = 0x0,
-        NoLock = 0x1
+        NoLock = 0x1,
+        PrefixIndex = 0x2 // only has an effect for String keys
     };
     bool load(const Path &path, uint32_t options, String *error = 0)
     {
@@ -157,6 +353,24 @@ public:
         return read<Value>(valuesSegment(), index);
     }
 
+    // Views point straight into the mapped file, see StringView,
+    // LocationSpan and SymbolView. Only available for variable sized types.
+    template <typename View>
+    View keyView(uint32_t index) const
+    {
+        assert(index >= 0 && index < mCount);
+        assert(!FixedSize<Key>::value);
+        return View(mPointer + offsetAt(keysSegment(), index));
+    }
+
+    template <typename View>
+    View valueView(uint32_t index) const
+    {
+        assert(index >= 0 && index < mCount);
+        assert(!FixedSize<Value>::value);
+        return View(mPointer + offsetAt(valuesSegment(), index));
+    }
+
     uint32_t lowerBound(const Key &k, bool *match = 0) const
     {
         if (!mCount) {
@@ -165,12 +379,17 @@ public:
             return std::numeric_limits<uint32_t>::max();
 
         }
+        if (mPrefixes) {
+            uint64_t prefix;
+            if (keyPrefix(k, prefix))
+                return prefixLowerBound(k, prefix, match);
+        }
         int lower = 0;
         int upper = mCount - 1;
 
         do {
             const int mid = lower + ((upper - lower) / 2);
-            const int cmp = compare<Key>(k, keyAt(mid));
+            const int cmp = compareKey(k, mid);
             if (cmp < 0) {
                 upper = mid - 1;
             } else if (cmp > 0) {
@@ -189,11 +408,17 @@ public:
         return lower;
     }
 
-    static String encode(const Map<Key, Value> &map)
+    // With PrefixIndex the first 8 bytes of every key are stored in a
+    // contiguous array after the values, followed by every BlockSize'th
+    // prefix and the offset of the prefix array. lowerBound() searches the
+    // small block array, then a single block, and only deserializes keys when
+    // prefixes are equal. The high bit of the count marks the layout.
+    static String encode(const Map<Key, Value> &map, uint32_t options = 0)
     {
         String out;
         Serializer serializer(out);
-        serializer << static_cast<uint32_t>(map.size());
+        const bool prefixIndex = (options & PrefixIndex) && !FixedSize<Key>::value && !map.isEmpty();
+        serializer << (static_cast<uint32_t>(map.size()) | (prefixIndex ? static_cast<uint32_t>(HasPrefixIndex) : 0));
         uint32_t valuesOffset;
         if (uint32_t size = FixedSize<Key>::value) {
             valuesOffset = ((static_cast<uint32_t>(map.size()) * size) + (sizeof(uint32_t) * 2));
@@ -233,6 +458,20 @@ public:
             out.append(valueData);
 
         }
+        if (prefixIndex) {
+            const uint32_t prefixOffset = out.size();
+            List<uint64_t> prefixes;
+            prefixes.reserve(map.size());
+            for (const std::pair<Key, Value> &pair : map) {
+                uint64_t prefix = 0;
+                keyPrefix(pair.first, prefix);
+                prefixes.append(prefix);
+            }
+            out.append(reinterpret_cast<const char*>(prefixes.data()), prefixes.size() * sizeof(uint64_t));
+            for (size_t i=0; i<prefixes.size(); i += BlockSize)
+                out.append(reinterpret_cast<const char*>(&prefixes.at(i)), sizeof(uint64_t));
+            out.append(reinterpret_cast<const char*>(&prefixOffset), sizeof(prefixOffset));
+        }
         return out;
     }
     static size_t write(const Path &path, const Map<Key, Value> &map, uint32_t options)
@@ -249,7 +488,7 @@ public:
             ::close(fd);
             return 0;
         }
-        const String data = encode(map);
+        const String data = encode(map, options);
         bool ok = ::ftruncate(fd, data.size()) != -1;
         if (!ok) {
             if (!(options & NoLock))
@@ -287,6 +526,99 @@ private:
     const char *valuesSegment() const { return mPointer + mValuesOffset; }
     const char *keysSegment() const { return mPointer + (sizeof(uint32_t) * 2); }
 
+    static uint32_t offsetAt(const char *base, uint32_t index)
+    {
+        uint32_t offset;
+        memcpy(&offset, base + (sizeof(uint32_t) * index), sizeof(offset));
+        return offset;
+    }
+
+    template <typename T>
+    int compareKey(const T &key, uint32_t index) const
+    {
+        return compare<T>(key, keyAt(index));
+    }
+
+    int compareKey(const String &key, uint32_t index) const
+    {
+        return -keyView<StringView>(index).compare(key);
+    }
+
+    enum {
+        HasPrefixIndex = 0x80000000,
+        BlockSize = 16
+    };
+
+    // big endian so that comparing prefixes as integers matches memcmp
+    static bool keyPrefix(const String &key, uint64_t &prefix)
+    {
+        prefix = 0;
+        const uint32_t size = key.size();
+        for (uint32_t i=0; i<sizeof(prefix); ++i)
+            prefix = (prefix << 8) | (i < size ? static_cast<unsigned char>(key.at(i)) : 0);
+        return true;
+    }
+
+    template <typename T>
+    static bool keyPrefix(const T &, uint64_t &)
+    {
+        return false;
+    }
+
+    uint64_t prefixAt(const char *base, uint32_t index) const
+    {
+        uint64_t prefix;
+        memcpy(&prefix, base + (index * sizeof(uint64_t)), sizeof(prefix));
+        return prefix;
+    }
+
+    // first index whose prefix is >= prefix (or > prefix if upper is true)
+    uint32_t prefixBound(uint64_t prefix, bool upper) const
+    {
+        auto before = [prefix, upper](uint64_t p) { return upper ? p <= prefix : p < prefix; };
+        uint32_t lower = 0, count = (mCount + BlockSize - 1) / BlockSize;
+        while (count) {
+            const uint32_t step = count / 2;
+            if (before(prefixAt(mBlocks, lower + step))) {
+                lower += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        // blocks [0, lower) start before prefix so the answer is in block lower - 1
+        uint32_t idx = lower ? (lower - 1) * BlockSize : 0;
+        const uint32_t end = std::min<uint32_t>(mCount, lower * BlockSize);
+        while (idx < end && before(prefixAt(mPrefixes, idx)))
+            ++idx;
+        return idx;
+    }
+
+    uint32_t prefixLowerBound(const Key &k, uint64_t prefix, bool *match) const
+    {
+        uint32_t lower = prefixBound(prefix, false);
+        uint32_t upper = lower;
+        if (lower < mCount && prefixAt(mPrefixes, lower) == prefix)
+            upper = prefixBound(prefix, true);
+        // only keys sharing our prefix need a real comparison
+        while (lower < upper) {
+            const uint32_t mid = lower + ((upper - lower) / 2);
+            const int cmp = compareKey(k, mid);
+            if (cmp < 0) {
+                upper = mid;
+            } else if (cmp > 0) {
+                lower = mid + 1;
+            } else {
+                if (match)
+                    *match = true;
+                return mid;
+            }
+        }
+        if (match)
+            *match = false;
+        return lower == mCount ? std::numeric_limits<uint32_t>::max() : lower;
+    }
+
     template <typename T>
     inline T read(const char *base, uint32_t index) const
     {
@@ -295,9 +627,7 @@ private:
             memcpy(&t, base + (index * size), FixedSize<T>::value);
             return t;
         }
-        uint32_t offset;
-        memcpy(&offset, base + (sizeof(uint32_t) * index), sizeof(offset));
-        Deserializer deserializer(mPointer + offset, INT_MAX);
+        Deserializer deserializer(mPointer + offsetAt(base, index), INT_MAX);
         T t;
         deserializer >> t;
         return t;
@@ -309,6 +639,231 @@ private:
     uint32_t mValuesOffset;
     int mFD;
     uint32_t mOptions;
+    const char *mPrefixes, *mBlocks;
+    std::shared_ptr<const FileMapContainer> mContainer;
+};
+
+// The FileMaps written for each indexed file, the section ids in its
+// FileMapContainer
+enum FileMapType {
+    Symbols,
+    SymbolNames,
+    Targets,
+    Usrs,
+    Tokens,
+    Subclasses, // base class usr -> derived class definitions
+    Callees, // caller usr -> callee usrs
+    Callers // callee usr -> caller usrs
 };
 
+inline const char *fileMapName(FileMapType type)
+{
+    switch (type) {
+    case Symbols: return "symbols";
+    case SymbolNames: return "symnames";
+    case Targets: return "targets";
+    case Usrs: return "usrs";
+    case Tokens: return "tokens";
+    case Subclasses: return "subclasses";
+    case Callees: return "callees";
+    case Callers: return "callers";
+    }
+    return 0;
+}
+
+// Several encoded FileMaps packed into one file. The file starts with a
+// section table:
+// [magic u32][section count u32] { [id u32][offset u32][size u32] }*
+// followed by the sections. Files are written to a temp file and renamed
+// into place so readers never need to lock them.
+class FileMapContainer : public std::enable_shared_from_this<FileMapContainer>
+{
+public:
+    enum { Magic = 0x4d465452 }; // "RTFM"
+    static const char *fileName() { return "filemaps"; }
+
+    FileMapContainer()
+        : mPointer(0), mSize(0), mCount(0)
+    {}
+
+    ~FileMapContainer()
+    {
+        if (mPointer)
+            munmap(const_cast<char*>(mPointer), mSize);
+    }
+
+    bool load(const Path &path, String *error = 0)
+    {
+        int fd;
+        eintrwrap(fd, open(path.constData(), O_RDONLY));
+        if (fd == -1) {
+            if (error)
+                *error = Rct::strerror();
+            return false;
+        }
+        struct stat st;
+        const char *pointer = 0;
+        if (fstat(fd, &st)) {
+            if (error)
+                *error = Rct::strerror();
+        } else if (st.st_size < static_cast<off_t>(headerSize(0))) {
+            if (error)
+                *error = "Invalid container " + path;
+        } else {
+            pointer = static_cast<const char*>(mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+            if (pointer == MAP_FAILED) {
+                pointer = 0;
+                if (error)
+                    *error = Rct::strerror();
+            }
+        }
+        // the mapping stays valid after the fd is closed
+        int ret;
+        eintrwrap(ret, close(fd));
+        if (!pointer)
+            return false;
+
+        mPointer = pointer;
+        mSize = st.st_size;
+        uint32_t magic;
+        memcpy(&magic, mPointer, sizeof(magic));
+        memcpy(&mCount, mPointer + sizeof(uint32_t), sizeof(mCount));
+        if (magic != Magic || headerSize(mCount) > mSize) {
+            if (error)
+                *error = "Invalid container " + path;
+            return false;
+        }
+        for (uint32_t i=0; i<mCount; ++i) {
+            const Section s = sectionAt(i);
+            if (static_cast<uint64_t>(s.offset) + s.size > mSize) {
+                if (error)
+                    *error = String::format<64>("Truncated section %u in ", s.id) + path;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool contains(uint32_t id) const { return find(id) != mCount; }
+    uint32_t size() const { return mSize; }
+
+    template <typename Key, typename Value>
+    std::shared_ptr<FileMap<Key, Value> > fileMap(uint32_t id) const
+    {
+        const uint32_t idx = find(id);
+        if (idx == mCount)
+            return std::shared_ptr<FileMap<Key, Value> >();
+        const Section s = sectionAt(idx);
+        auto ret = std::make_shared<FileMap<Key, Value> >();
+        ret->init(mPointer + s.offset, s.size, shared_from_this());
+        return ret;
+    }
+
+    class Writer
+    {
+    public:
+        void add(uint32_t id, String &&data) { mSections.append(std::make_pair(id, std::move(data))); }
+
+        // If unchanged is passed and path already has these exact contents
+        // it's left alone, its mapping and the caches built on it stay
+        // valid. Returns 0 on failure.
+        size_t write(const Path &path, bool *unchanged = 0) const
+        {
+            String header;
+            header.resize(headerSize(mSections.size()));
+            char *out = header.data();
+            const uint32_t magic = Magic;
+            const uint32_t count = mSections.size();
+            memcpy(out, &magic, sizeof(magic));
+            memcpy(out + sizeof(uint32_t), &count, sizeof(count));
+            uint32_t offset = header.size();
+            for (uint32_t i=0; i<count; ++i) {
+                const uint32_t entry[] = { mSections.at(i).first, offset, static_cast<uint32_t>(mSections.at(i).second.size()) };
+                memcpy(out + headerSize(i), entry, sizeof(entry));
+                offset += entry[2];
+            }
+
+            if (unchanged && (*unchanged = matches(path, header, offset)))
+                return offset;
+
+            const Path tmp = String::format<PATH_MAX>("%s.%d", path.constData(), getpid());
+            FILE *f = fopen(tmp.constData(), "w");
+            if (!f) {
+                if (!Path::mkdir(path.parentDir(), Path::Recursive) || !(f = fopen(tmp.constData(), "w")))
+                    return 0;
+            }
+            bool ok = fwrite(header.constData(), header.size(), 1, f);
+            for (const auto &section : mSections) {
+                if (!ok)
+                    break;
+                ok = section.second.isEmpty() || fwrite(section.second.constData(), section.second.size(), 1, f);
+            }
+            ok = !fclose(f) && ok;
+            if (!ok || rename(tmp.constData(), path.constData())) {
+                unlink(tmp.constData());
+                return 0;
+            }
+            return offset;
+        }
+    private:
+        bool matches(const Path &path, const String &header, uint32_t size) const
+        {
+            int fd;
+            eintrwrap(fd, open(path.constData(), O_RDONLY));
+            if (fd == -1)
+                return false;
+            bool ret = false;
+            struct stat st;
+            if (!fstat(fd, &st) && st.st_size == size) {
+                void *pointer = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (pointer != MAP_FAILED) {
+                    const char *data = static_cast<const char*>(pointer);
+                    ret = !memcmp(data, header.constData(), header.size());
+                    data += header.size();
+                    for (const auto &section : mSections) {
+                        if (!ret)
+                            break;
+                        ret = !memcmp(data, section.second.constData(), section.second.size());
+                        data += section.second.size();
+                    }
+                    munmap(pointer, size);
+                }
+            }
+            int r;
+            eintrwrap(r, close(fd));
+            return ret;
+        }
+
+        List<std::pair<uint32_t, String> > mSections;
+    };
+private:
+    struct Section {
+        uint32_t id, offset, size;
+    };
+    static uint32_t headerSize(uint32_t count) { return (sizeof(uint32_t) * 2) + (count * sizeof(Section)); }
+    Section sectionAt(uint32_t idx) const
+    {
+        Section s;
+        memcpy(&s, mPointer + headerSize(idx), sizeof(s));
+        return s;
+    }
+    uint32_t find(uint32_t id) const
+    {
+        for (uint32_t i=0; i<mCount; ++i) {
+            if (sectionAt(i).id == id)
+                return i;
+        }
+        return mCount;
+    }
+
+    const char *mPointer;
+    uint32_t mSize, mCount;
+};
+
+// Keeps containers mapped between queries, least recently used ones are
+// dropped once the mapped bytes or the number of mappings exceed the budget.
+// Containers don't hold on to their fd so the count is the only limit on
+// mappings.
+typedef GenerationLRUCache<uint32_t, FileMapContainer> FileMapCache;
+
 #endif
@@ -54,7 +54,7 @@ int FollowLocationJob::execute()
         const Set<String> usrs = project()->findTargetUsrs(location);
         for (const String &usr : usrs) {
             for (const Symbol &s : project()->findByUsr(usr, location.fileId(), Project::All)) {
-                write(s.toString());
+                write(s.toString(project()));
             }
         }
         return 0;
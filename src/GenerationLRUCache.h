@@ -0,0 +1,142 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef GenerationLRUCache_h
+#define GenerationLRUCache_h
+
+#include <assert.h>
+#include <stdint.h>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "rct/Hash.h"
+
+// Values loaded from files on disk, least recently used ones are dropped once
+// their size() or their count exceed the budget. Loads happen without the
+// lock so a value is only cached if its key's generation didn't change while
+// it was being loaded. Thread safe.
+template <typename Key, typename T>
+class GenerationLRUCache
+{
+public:
+    GenerationLRUCache(size_t maxBytes, size_t maxCount = std::numeric_limits<size_t>::max())
+        : mMaxBytes(maxBytes), mMaxCount(maxCount), mBytes(0), mLastGeneration(0), mDefaultGeneration(0)
+    {}
+
+    struct Stats {
+        Stats()
+            : hits(0), misses(0), evictions(0), invalidations(0), bytes(0), count(0)
+        {}
+        size_t hits, misses, evictions, invalidations, bytes, count;
+    };
+
+    std::shared_ptr<T> find(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(key);
+        if (it == mEntries.end()) {
+            ++mStats.misses;
+            return std::shared_ptr<T>();
+        }
+        ++mStats.hits;
+        mLRU.splice(mLRU.end(), mLRU, it->second.position);
+        return it->second.value;
+    }
+
+    // Read before loading the value and passed to insert(). A value loaded
+    // before its key was remove()d or forget()ten is not cached.
+    uint32_t generation(const Key &key) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mGenerations.value(key, mDefaultGeneration);
+    }
+
+    void insert(const Key &key, const std::shared_ptr<T> &value, uint32_t generation)
+    {
+        if (value->size() > mMaxBytes)
+            return;
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mGenerations.value(key, mDefaultGeneration) != generation)
+            return;
+        take(key);
+        Entry &entry = mEntries[key];
+        entry.value = value;
+        entry.position = mLRU.insert(mLRU.end(), key);
+        mBytes += value->size();
+        while (mBytes > mMaxBytes || mEntries.size() > mMaxCount) {
+            assert(!mLRU.empty());
+            take(mLRU.front());
+            ++mStats.evictions;
+        }
+    }
+
+    // the file has been rewritten
+    void remove(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mGenerations[key] = ++mLastGeneration;
+        if (take(key))
+            ++mStats.invalidations;
+    }
+
+    // The file is gone, its generation is dropped too. Generations are never
+    // reused so a load that's still in flight can't match the default one.
+    void forget(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mGenerations.remove(key);
+        mDefaultGeneration = ++mLastGeneration;
+        if (take(key))
+            ++mStats.invalidations;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Stats ret = mStats;
+        ret.bytes = mBytes;
+        ret.count = mEntries.size();
+        return ret;
+    }
+private:
+    bool take(const Key &key)
+    {
+        auto it = mEntries.find(key);
+        if (it == mEntries.end())
+            return false;
+        mBytes -= it->second.value->size();
+        mLRU.erase(it->second.position);
+        mEntries.erase(it);
+        return true;
+    }
+
+    struct Entry {
+        std::shared_ptr<T> value;
+        typename std::list<Key>::iterator position;
+    };
+
+    mutable std::mutex mMutex;
+    const size_t mMaxBytes, mMaxCount;
+    size_t mBytes;
+    uint32_t mLastGeneration, mDefaultGeneration;
+    Hash<Key, Entry> mEntries;
+    Hash<Key, uint32_t> mGenerations; // keys that were remove()d
+    std::list<Key> mLRU;
+    Stats mStats;
+};
+
+#endif
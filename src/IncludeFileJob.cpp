@@ -15,6 +15,7 @@
 
 #include "IncludeFileJob.h"
 
+#include "DependencyGraph.h"
 #include "Project.h"
 #include "RTags.h"
 #include "Server.h"
@@ -40,14 +41,13 @@ static inline List<Path> headersForSymbol(const std::shared_ptr<Project> &projec
     const Path &path = loc.path();
     if (path.isHeader()) {
         ret.append(path);
-        if (const DependencyNode *node = project->dependencies().value(loc.fileId())) {
-            for (const auto &dependent : node->dependents) {
-                const Path p = Location::path(dependent.first);
-                if (p.isHeader() && dependent.second->includes.size() == 1) {
-                    ret.append(p);
-                    // allow headers that only include one header if we don't
-                    // find anything for the real header
-                }
+        const std::shared_ptr<const DependencyGraph> graph = project->dependencyGraph();
+        for (uint32_t dependent : graph->edges(loc.fileId(), DependencyGraph::Dependents)) {
+            const Path p = Location::path(dependent);
+            if (p.isHeader() && graph->edgeCount(dependent, DependencyGraph::Includes) == 1) {
+                ret.append(p);
+                // allow headers that only include one header if we don't
+                // find anything for the real header
             }
         }
     }
@@ -59,6 +59,16 @@ public:
         return ret;
     }
 
+    Set<uint32_t> changedFiles() const
+    {
+        Set<uint32_t> ret;
+        for (const auto &it : mFiles) {
+            if ((it.second & (Visited|Unchanged)) == Visited)
+                ret.insert(it.first);
+        }
+        return ret;
+    }
+
     Set<uint32_t> blockedFiles() const
     {
         Set<uint32_t> ret;
@@ -91,11 +101,23 @@ public:
         NoFileFlag = 0x0,
         Visited = 0x1,
         HeaderError = 0x2,
-        IncludeError = 0x4
+        IncludeError = 0x4,
+        Unchanged = 0x8 // visited but its FileMaps were identical and not rewritten
     };
     Hash<uint32_t, Flags<FileFlag> > &files() { return mFiles; }
     const Hash<uint32_t, Flags<FileFlag> > &files() const { return mFiles; }
 
+    // Contents of visited files that didn't change while they were parsed
+    struct FileHash {
+        uint64_t hash, lastModified;
+    };
+    Hash<uint32_t, FileHash> &fileHashes() { return mFileHashes; }
+    const Hash<uint32_t, FileHash> &fileHashes() const { return mFileHashes; }
+
+    // Size of the FileMaps file rp wrote for each visited file
+    Hash<uint32_t, uint32_t> &fileMapSizes() { return mFileMapSizes; }
+    const Hash<uint32_t, uint32_t> &fileMapSizes() const { return mFileMapSizes; }
+
     size_t bytesWritten() const { return mBytesWritten; }
     void setBytesWritten(size_t bytes) { mBytesWritten = bytes; }
 private:
@@ -107,6 +129,8 @@ private:
     Diagnostics mDiagnostics;
     Includes mIncludes;
     Hash<uint32_t, Flags<FileFlag> > mFiles;
+    Hash<uint32_t, FileHash> mFileHashes;
+    Hash<uint32_t, uint32_t> mFileMapSizes;
     Flags<Flag> mFlags;
     size_t mBytesWritten;
 };
@@ -114,16 +138,28 @@ private:
 RCT_FLAGS(IndexDataMessage::Flag);
 RCT_FLAGS(IndexDataMessage::FileFlag);
 
+inline Serializer &operator<<(Serializer &s, const IndexDataMessage::FileHash &fileHash)
+{
+    s << fileHash.hash << fileHash.lastModified;
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, IndexDataMessage::FileHash &fileHash)
+{
+    s >> fileHash.hash >> fileHash.lastModified;
+    return s;
+}
+
 inline void IndexDataMessage::encode(Serializer &serializer) const
 {
     serializer << mProject << mParseTime << mId << mIndexerJobFlags << mMessage
-               << mFixIts << mIncludes << mDiagnostics << mFiles << mFlags << mBytesWritten;
+               << mFixIts << mIncludes << mDiagnostics << mFiles << mFileHashes << mFileMapSizes << mFlags << mBytesWritten;
 }
 
 inline void IndexDataMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mProject >> mParseTime >> mId >> mIndexerJobFlags >> mMessage
-                 >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mFlags >> mBytesWritten;
+                 >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mFileHashes >> mFileMapSizes >> mFlags >> mBytesWritten;
 }
 
 #endif
@@ -85,8 +85,11 @@ inline Deserializer &operator>>(Deserializer &s, IndexParseData::CompileCommands
     return s;
 }
 
+// Most sources in a project share their include paths, defines and
+// arguments so those are written once
 inline Serializer &operator<<(Serializer &s, const IndexParseData &data)
 {
+    const Source::BlockTables tables;
     s << data.project << static_cast<uint32_t>(data.compileCommands.size());
     for (const auto &pair : data.compileCommands) {
         s << Location::path(pair.first) << pair.second;
@@ -97,6 +100,7 @@ inline Serializer &operator<<(Serializer &s, const IndexParseData &data)
 
 inline Deserializer &operator>>(Deserializer &s, IndexParseData &data)
 {
+    const Source::BlockTables tables;
     s >> data.project;
     data.compileCommands.clear();
     uint32_t size;
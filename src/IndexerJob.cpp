@@ -15,7 +15,10 @@
 
 #include "IndexerJob.h"
 
+#include <algorithm>
+
 #include "CompilerManager.h"
+#include "DependencyGraph.h"
 #include "Project.h"
 #include "rct/Process.h"
 #include "JobScheduler.h"
@@ -29,7 +32,7 @@ IndexerJob::IndexerJob(const SourceList &s,
                        const std::shared_ptr<Project> &p,
                        const UnsavedFiles &u)
     : id(0), flags(f),
-      project(p->path()), unsavedFiles(u), crashCount(0), mCachedPriority(INT_MIN)
+      project(p->path()), unsavedFiles(u), crashCount(0), predictedDuration(0), predictedMemory(0), mCachedPriority(INT_MIN)
 {
     sources.append(s.front());
     for (size_t i=1; i<s.size(); ++i) {
@@ -47,6 +50,8 @@ IndexerJob::IndexerJob(const SourceList &s,
 
     assert(!sources.isEmpty());
     sourceFile = s.begin()->sourceFile();
+    predictedDuration = p->predictedIndexDuration(sources.begin()->fileId);
+    predictedMemory = p->predictedIndexMemory(sources.begin()->fileId);
     acquireId();
     visited.insert(sources.begin()->fileId);
 }
@@ -76,25 +81,20 @@ int IndexerJob::priority() const
             } else if (flags & Reindex) {
                 ret += 4;
             }
+            // deferred jobs go last but still ahead of ones stuck on a
+            // header error (-1)
+            if (flags & Deferred)
+                ret = std::max(ret - 3, 0);
             std::shared_ptr<Project> p = server->project(project);
             if (server->isActiveBuffer(fileId)) {
                 ret += 8;
             } else if (p) {
-                if (DependencyNode *node = p->dependencyNode(fileId)) {
-                    Set<DependencyNode*> seen;
-                    seen.insert(node);
-                    std::function<bool(const DependencyNode *node)> func = [&seen, server, &func](const DependencyNode *n) {
-                        for (const auto &inc : n->includes) {
-                            if (seen.insert(inc.second)
-                                && !Location::path(n->fileId).isSystem()
-                                && (server->isActiveBuffer(n->fileId) || func(inc.second))) {
-                                return true;
-                            }
-                        }
-                        return false;
-                    };
-                    if (func(node))
+                // one of the headers it includes is open
+                for (uint32_t inc : *p->dependencyGraph()->closure(fileId, DependencyGraph::Includes)) {
+                    if (inc != fileId && server->isActiveBuffer(inc) && !Location::path(inc).isSystem()) {
                         ret += 2;
+                        break;
+                    }
                 }
             }
         }
@@ -118,20 +118,21 @@ String IndexerJob::encode() const
                    << project
                    << static_cast<uint32_t>(sources.size());
         for (Source copy : sources) {
+            List<String> &arguments = copy.arguments.mutate();
             if (!(options.options & Server::AllowWErrorAndWFatalErrors)) {
-                int idx = copy.arguments.indexOf("-Werror");
+                int idx = arguments.indexOf("-Werror");
                 if (idx != -1)
-                    copy.arguments.removeAt(idx);
-                idx = copy.arguments.indexOf("-Wfatal-errors");
+                    arguments.removeAt(idx);
+                idx = arguments.indexOf("-Wfatal-errors");
                 if (idx != -1)
-                    copy.arguments.removeAt(idx);
+                    arguments.removeAt(idx);
             }
-            copy.arguments << options.defaultArguments;
+            arguments << options.defaultArguments;
 
             if (!(options.options & Server::AllowPedantic)) {
-                const int idx = copy.arguments.indexOf("-Wpedantic");
+                const int idx = arguments.indexOf("-Wpedantic");
                 if (idx != -1) {
-                    copy.arguments.removeAt(idx);
+                    arguments.removeAt(idx);
                 }
             }
 
@@ -142,32 +143,33 @@ String IndexerJob::encode() const
             for (const String &blocked : options.blockedArguments) {
                 if (blocked.endsWith("=")) {
                     size_t i = 0;
-                    while (i<copy.arguments.size()) {
-                        if (copy.arguments.at(i).startsWith(blocked)) {
-                            // error() << "Removing" << copy.arguments.at(i);
-                            copy.arguments.remove(i, 1);
-                        } else if (!strncmp(blocked.constData(), copy.arguments.at(i).constData(), blocked.size() - 1)) {
-                            const size_t count = (i + 1 < copy.arguments.size()) ? 2 : 1;
-                            // error() << "Removing" << copy.arguments.mid(i, count);
-                            copy.arguments.remove(i, count);
+                    while (i<arguments.size()) {
+                        if (arguments.at(i).startsWith(blocked)) {
+                            // error() << "Removing" << arguments.at(i);
+                            arguments.remove(i, 1);
+                        } else if (!strncmp(blocked.constData(), arguments.at(i).constData(), blocked.size() - 1)) {
+                            const size_t count = (i + 1 < arguments.size()) ? 2 : 1;
+                            // error() << "Removing" << arguments.mid(i, count);
+                            arguments.remove(i, count);
                         } else {
                             ++i;
                         }
                     }
                 } else {
-                    copy.arguments.remove(blocked);
+                    arguments.remove(blocked);
                 }
             }
 
             for (const auto &inc : options.includePaths) {
-                copy.includePaths << inc;
+                copy.includePaths.mutate() << inc;
             }
             if (Server::instance()->options().options & Server::PCHEnabled)
                 proj->fixPCH(copy);
 
-            copy.defines << options.defines;
+            Set<Source::Define> &defines = copy.defines.mutate();
+            defines << options.defines;
             if (!(options.options & Server::EnableNDEBUG)) {
-                copy.defines.remove(Source::Define("NDEBUG"));
+                defines.remove(Source::Define("NDEBUG"));
             }
             assert(!sourceFile.isEmpty());
             copy.encode(serializer, Source::IgnoreSandbox);
@@ -216,6 +218,9 @@ String IndexerJob::dumpFlags(Flags<Flag> flags)
     if (flags & Complete) {
         ret += "Complete";
     }
+    if (flags & Deferred) {
+        ret += "Deferred";
+    }
 
     return String::join(ret, ", ");
 }
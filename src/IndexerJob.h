@@ -34,6 +34,7 @@ public:
         Aborted = 0x040,
         Complete = 0x080,
         NoAbort = 0x100,
+        Deferred = 0x200, // another source is reindexing the modified header first
         Type_Mask = Dirty|Compile|Reindex
     };
 
@@ -61,6 +62,8 @@ public:
     UnsavedFiles unsavedFiles;
     Set<uint32_t> visited;
     int crashCount;
+    uint32_t predictedDuration; // ms, 0 if unknown
+    size_t predictedMemory; // bytes, 0 if unknown
     Signal<std::function<void(IndexerJob *)> > destroyed;
 
 private:
@@ -0,0 +1,258 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef Interned_h
+#define Interned_h
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Log.h"
+#include "rct/Serializer.h"
+#include "rct/String.h"
+
+namespace RTags {
+uint64_t contentHash(const char *data, size_t size);
+}
+
+// Copy on write, hash-consed value. Equal values that have been assigned
+// share one refcounted block so thousands of sources with the same include
+// paths and defines cost one list. mutate() detaches from the shared block,
+// assign or intern() the result to share it again.
+template <typename T>
+class Interned
+{
+public:
+    Interned()
+        : mCanonical(false)
+    {}
+    Interned(const T &t)
+        : mData(intern(t)), mCanonical(true)
+    {}
+
+    const T &get() const { return mData ? *mData : empty(); }
+    operator const T &() const { return get(); }
+    const T *operator->() const { return &get(); }
+    typename T::const_iterator begin() const { return get().begin(); }
+    typename T::const_iterator end() const { return get().end(); }
+    size_t size() const { return get().size(); }
+    bool isEmpty() const { return get().isEmpty(); }
+    // how many values share the block, 0 for an empty value
+    long useCount() const { return mData.use_count(); }
+
+    T &mutate()
+    {
+        if (!mData) {
+            mData = std::make_shared<T>();
+        } else if (mCanonical || mData.use_count() > 1) {
+            mData = std::make_shared<T>(*mData);
+        }
+        mCanonical = false;
+        return *mData;
+    }
+    void intern()
+    {
+        if (!mCanonical) {
+            mData = mData ? intern(*mData) : std::shared_ptr<T>();
+            mCanonical = true;
+        }
+    }
+    void clear()
+    {
+        mData.reset();
+        mCanonical = false;
+    }
+
+    // the same block has the same contents, the reverse only holds if both
+    // have been interned
+    bool isSameBlock(const Interned &other) const { return mData == other.mData; }
+    int compare(const Interned &other) const
+    {
+        return mData == other.mData ? 0 : get().compare(other.get());
+    }
+    // Two interned blocks are only equal if they're the same block
+    bool operator==(const Interned &other) const
+    {
+        if (mData == other.mData)
+            return true;
+        if (mCanonical && other.mCanonical)
+            return false;
+        return get() == other.get();
+    }
+    bool operator!=(const Interned &other) const { return !operator==(other); }
+
+    // While a Table exists on a thread each block is serialized once and
+    // referred to by its index after that. Has to be used for both encoding
+    // and decoding.
+    class Table
+    {
+    public:
+        Table()
+            : mPrevious(sTable)
+        {
+            sTable = this;
+        }
+        ~Table()
+        {
+            sTable = mPrevious;
+        }
+    private:
+        Table *mPrevious;
+        Hash<const T*, uint32_t> mIds;
+        List<std::shared_ptr<T> > mBlocks;
+        friend class Interned<T>;
+    };
+
+    void encode(Serializer &serializer) const
+    {
+        if (!sTable) {
+            serializer << get();
+            return;
+        }
+        // 0 is the empty value, an id the reader hasn't seen is followed by the block
+        const std::shared_ptr<T> block = mCanonical || !mData ? mData : intern(*mData);
+        if (!block) {
+            serializer << static_cast<uint32_t>(0);
+            return;
+        }
+        uint32_t &id = sTable->mIds[block.get()];
+        if (id) {
+            serializer << id;
+        } else {
+            sTable->mBlocks.append(block);
+            id = sTable->mBlocks.size();
+            serializer << id << *block;
+        }
+    }
+
+    void decode(Deserializer &deserializer)
+    {
+        if (!sTable) {
+            T t;
+            deserializer >> t;
+            *this = t;
+            return;
+        }
+        uint32_t id;
+        deserializer >> id;
+        if (!id) {
+            clear();
+        } else if (id <= sTable->mBlocks.size()) {
+            mData = sTable->mBlocks.at(id - 1);
+            mCanonical = true;
+        } else {
+            T t;
+            deserializer >> t;
+            *this = t;
+            sTable->mBlocks.append(mData);
+        }
+    }
+private:
+    static const T &empty()
+    {
+        static const T e;
+        return e;
+    }
+
+    struct Pool
+    {
+        Pool()
+            : count(0), sweepAt(1024)
+        {}
+        std::mutex mutex;
+        Hash<uint64_t, List<std::weak_ptr<T> > > blocks;
+        size_t count, sweepAt;
+    };
+
+    static Pool &pool()
+    {
+        static Pool p;
+        return p;
+    }
+
+    static std::shared_ptr<T> intern(const T &t)
+    {
+        if (t.isEmpty())
+            return std::shared_ptr<T>();
+        String data;
+        {
+            Serializer serializer(data);
+            serializer << t;
+        }
+        const uint64_t hash = RTags::contentHash(data.constData(), data.size());
+        Pool &p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        List<std::weak_ptr<T> > &bucket = p.blocks[hash];
+        for (const std::weak_ptr<T> &weak : bucket) {
+            std::shared_ptr<T> block = weak.lock();
+            if (block && *block == t)
+                return block;
+        }
+        std::shared_ptr<T> block = std::make_shared<T>(t);
+        bucket.append(block);
+        if (++p.count >= p.sweepAt) {
+            p.count = 0;
+            auto it = p.blocks.begin();
+            while (it != p.blocks.end()) {
+                List<std::weak_ptr<T> > &weaks = it->second;
+                weaks.erase(std::remove_if(weaks.begin(), weaks.end(),
+                                           [](const std::weak_ptr<T> &weak) { return weak.expired(); }),
+                            weaks.end());
+                if (weaks.isEmpty()) {
+                    p.blocks.erase(it++);
+                } else {
+                    p.count += weaks.size();
+                    ++it;
+                }
+            }
+            p.sweepAt = std::max<size_t>(1024, p.count * 2);
+        }
+        return block;
+    }
+
+    std::shared_ptr<T> mData;
+    bool mCanonical;
+    static thread_local Table *sTable;
+};
+
+template <typename T>
+thread_local typename Interned<T>::Table *Interned<T>::sTable = 0;
+
+template <typename T>
+inline Serializer &operator<<(Serializer &s, const Interned<T> &t)
+{
+    t.encode(s);
+    return s;
+}
+
+template <typename T>
+inline Deserializer &operator>>(Deserializer &s, Interned<T> &t)
+{
+    t.decode(s);
+    return s;
+}
+
+template <typename T>
+inline Log operator<<(Log dbg, const Interned<T> &t)
+{
+    dbg << t.get();
+    return dbg;
+}
+
+#endif
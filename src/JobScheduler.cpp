@@ -15,6 +15,7 @@
 
 #include "JobScheduler.h"
 
+#include "DependencyGraph.h"
 #include "IndexDataMessage.h"
 #include "IndexerJob.h"
 #include "Project.h"
@@ -25,30 +26,53 @@
 enum { MaxPriority = 10 };
 // we set the priority to be this when a job has been requested and we couldn't load it
 JobScheduler::JobScheduler()
-    : mProcrastination(0)
-{}
+    : mProcrastination(0), mProcessesStarted(0), mThrottleCount(0), mThrottledJobs(0)
+{
+    mMemoryTimer.timeout().connect([this](Timer *) {
+            if (mActiveByProcess.isEmpty()) {
+                mMemoryTimer.stop();
+            } else {
+                sampleMemory();
+                if (mThrottledJobs)
+                    startJobs();
+            }
+        });
+}
 
 JobScheduler::~JobScheduler()
 {
+    mMemoryTimer.stop();
     mPendingJobs.deleteAll();
     if (!mActiveByProcess.isEmpty()) {
         for (const auto &job : mActiveByProcess) {
             job.first->kill();
         }
     }
+    for (Process *process : mIdleProcesses)
+        process->kill();
+}
+
+// Jobs with the same priority run longest first so a big source that
+// happens to be queued last doesn't make up the tail of a full reindex
+static bool runsBefore(const IndexerJob &l, const IndexerJob &r)
+{
+    const int lp = l.priority(), rp = r.priority();
+    if (lp != rp)
+        return lp > rp;
+    return l.predictedDuration > r.predictedDuration;
 }
 
 void JobScheduler::add(const std::shared_ptr<IndexerJob> &job)
 {
-    assert(!(job->flags & ~IndexerJob::Type_Mask));
-    std::shared_ptr<Node> node(new Node({ 0, job, 0, 0, 0, String() }));
+    assert(!(job->flags & ~(IndexerJob::Type_Mask|IndexerJob::Deferred)));
+    std::shared_ptr<Node> node(new Node({ 0, job, 0, 0, 0, String(), 0 }));
     node->job = job;
     // error() << job->priority << job->sourceFile << mProcrastination;
-    if (mPendingJobs.isEmpty() || job->priority() > mPendingJobs.first()->job->priority()) {
+    if (mPendingJobs.isEmpty() || runsBefore(*job, *mPendingJobs.first()->job)) {
         mPendingJobs.prepend(node);
     } else {
         std::shared_ptr<Node> after = mPendingJobs.last();
-        while (job->priority() > after->job->priority()) {
+        while (runsBefore(*job, *after->job)) {
             after = after->prev;
             assert(after);
         }
@@ -61,32 +85,15 @@ void JobScheduler::add(const std::shared_ptr<IndexerJob> &job)
         startJobs();
 }
 
-uint32_t JobScheduler::hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const
+uint32_t JobScheduler::hasHeaderError(uint32_t file, const std::shared_ptr<Project> &project) const
 {
-    assert(node);
-    for (auto dep : node->includes) {
-        if (!seen.insert(dep.first))
-            continue;
-
-        if (mHeaderErrors.contains(dep.first)) {
-            return dep.first;
-        }
-        if (uint32_t fileId = hasHeaderError(dep.second, seen)) {
-            return fileId;
-        }
+    for (uint32_t dep : *project->dependencyGraph()->closure(file, DependencyGraph::Includes)) {
+        if (dep != file && mHeaderErrors.contains(dep))
+            return dep;
     }
     return 0;
 }
 
-uint32_t JobScheduler::hasHeaderError(uint32_t file, const std::shared_ptr<Project> &project) const
-{
-    DependencyNode *node = project->dependencies().value(file);
-    if (!node)
-        return false;
-    Set<uint32_t> seen;
-    return hasHeaderError(node, seen);
-}
-
 void JobScheduler::startJobs()
 {
     Server *server = Server::instance();
@@ -103,6 +110,13 @@ void JobScheduler::startJobs()
         jobNode = tmp;
     };
 
+    // Hold back jobs that would push the rps over the memory budget, unless
+    // nothing is running at all
+    const size_t budget = static_cast<size_t>(std::max(options.jobMemoryBudget, 0)) * 1024 * 1024;
+    Hash<Process*, size_t> idleMemory;
+    size_t committed = budget && !mActiveByProcess.isEmpty() ? sampleMemory(&idleMemory) : 0;
+    mThrottledJobs = 0;
+
     while (mActiveByProcess.size() < options.jobCount && jobNode) {
         assert(jobNode);
         assert(jobNode->job);
@@ -114,31 +128,26 @@ void JobScheduler::startJobs()
             continue;
         }
 
-        const uint64_t jobId = jobNode->job->id;
-        Process *process = new Process;
-        debug() << "Starting process for" << jobId << jobNode->job->fileId() << jobNode->job.get();
-        List<String> arguments;
-        arguments << "--priority" << String::number(jobNode->job->priority());
-
-        for (int i=logLevel().toInt(); i>0; --i)
-            arguments << "-v";
-
-        process->readyReadStdOut().connect([this](Process *proc) {
-                std::shared_ptr<Node> n = mActiveByProcess[proc];
-                assert(n);
-                n->stdOut.append(proc->readAllStdOut());
-
-                std::regex rx("@CRASH@([^@]*)@CRASH@");
-                std::smatch match;
-                while (std::regex_search(n->stdOut.ref(), match, rx)) {
-                    error() << match[1].str();
-                    n->stdOut.remove(match.position(), match.length());
-                }
-            });
+        if (budget) {
+            // a reused idle rp is already counted, its RSS becomes part of
+            // the job's prediction
+            if (!mIdleProcesses.isEmpty())
+                committed -= std::min(committed, idleMemory.take(mIdleProcesses.first()));
+            if (!mActiveByProcess.isEmpty() && committed + jobNode->job->predictedMemory > budget) {
+                mThrottledJobs = mPendingJobs.size();
+                ++mThrottleCount;
+                debug() << "Holding back" << mThrottledJobs << "jobs," << committed << "of" << budget << "bytes committed";
+                break;
+            }
+            committed += jobNode->job->predictedMemory;
+        }
 
-        if (!process->start(options.rp, arguments)) {
-            error() << "Couldn't start rp" << options.rp << process->errorString();
-            delete process;
+        const uint64_t jobId = jobNode->job->id;
+        Process *process = 0;
+        if (!mIdleProcesses.isEmpty()) {
+            process = mIdleProcesses.takeFirst();
+            debug() << "Reusing process for" << jobId << jobNode->job->fileId() << jobNode->job.get();
+        } else if (!(process = startProcess(jobNode->job->priority()))) {
             jobNode->job->flags |= IndexerJob::Crashed;
             debug() << "job crashed (didn't start)" << jobId << jobNode->job->fileId() << jobNode->job.get();
             auto msg = std::make_shared<IndexDataMessage>(jobNode->job);
@@ -147,42 +156,15 @@ void JobScheduler::startJobs()
             cont();
             continue;
         }
-        process->finished().connect([this, jobId](Process *proc) {
-                EventLoop::deleteLater(proc);
-                auto n = mActiveByProcess.take(proc);
-                assert(!n || n->process == proc);
-                const String stdErr = proc->readAllStdErr();
-                if ((n && !n->stdOut.isEmpty()) || !stdErr.isEmpty()) {
-                    error() << (n ? ("Output from " + n->job->sourceFile + ":") : String("Orphaned process:"))
-                            << '\n' << stdErr << (n ? n->stdOut : String());
-                }
-
-                if (n) {
-                    assert(n->process == proc);
-                    n->process = 0;
-                    assert(!(n->job->flags & IndexerJob::Aborted));
-                    if (!(n->job->flags & IndexerJob::Complete) && proc->returnCode() != 0) {
-                        auto nodeById = mActiveById.take(jobId);
-                        assert(nodeById);
-                        assert(nodeById == n);
-                        // job failed, probably no IndexDataMessage coming
-                        n->job->flags |= IndexerJob::Crashed;
-                        debug() << "job crashed" << jobId << n->job->fileId() << n->job.get();
-                        auto msg = std::make_shared<IndexDataMessage>(n->job);
-                        msg->setFlag(IndexDataMessage::ParseFailure);
-                        jobFinished(n->job, msg);
-                    }
-                }
-                startJobs();
-            });
-
 
         jobNode->process = process;
-        assert(!(jobNode->job->flags & ~IndexerJob::Type_Mask));
+        assert(!(jobNode->job->flags & ~(IndexerJob::Type_Mask|IndexerJob::Deferred)));
         jobNode->job->flags |= IndexerJob::Running;
         process->write(jobNode->job->encode());
         jobNode->started = Rct::monoMs();
         mActiveByProcess[process] = jobNode;
+        if (budget && !mMemoryTimer.isRunning())
+            mMemoryTimer.restart(MemorySampleInterval);
         // error() << "STARTING JOB" << node->job->sourceFile;
         mInactiveById.remove(jobId);
         mActiveById[jobId] = jobNode;
@@ -190,6 +172,133 @@ void JobScheduler::startJobs()
     }
 }
 
+Process *JobScheduler::startProcess(int priority)
+{
+    const auto &options = Server::instance()->options();
+    Process *process = new Process;
+    List<String> arguments;
+    // rp ignores --priority, it's for wrappers. A persistent rp gets the
+    // priority of the job it was started for.
+    if (options.rpJobsPerProcess > 1)
+        arguments << "--persistent";
+    arguments << "--priority" << String::number(priority);
+
+    for (int i=logLevel().toInt(); i>0; --i)
+        arguments << "-v";
+
+    process->readyReadStdOut().connect([this](Process *proc) {
+            std::shared_ptr<Node> n = mActiveByProcess.value(proc);
+            const String out = proc->readAllStdOut();
+            if (!n) {
+                if (!out.isEmpty())
+                    error() << "Output from idle rp:" << out;
+                return;
+            }
+            n->stdOut.append(out);
+
+            std::regex rx("@CRASH@([^@]*)@CRASH@");
+            std::smatch match;
+            while (std::regex_search(n->stdOut.ref(), match, rx)) {
+                error() << match[1].str();
+                n->stdOut.remove(match.position(), match.length());
+            }
+        });
+
+    if (!process->start(options.rp, arguments)) {
+        error() << "Couldn't start rp" << options.rp << process->errorString();
+        delete process;
+        return 0;
+    }
+    ++mProcessesStarted;
+    mJobsByProcess[process] = 0;
+    process->finished().connect([this](Process *proc) {
+            EventLoop::deleteLater(proc);
+            mIdleProcesses.remove(proc);
+            mJobsByProcess.remove(proc);
+            auto n = mActiveByProcess.take(proc);
+            assert(!n || n->process == proc);
+            const String stdErr = proc->readAllStdErr();
+            if ((n && !n->stdOut.isEmpty()) || !stdErr.isEmpty()) {
+                error() << (n ? ("Output from " + n->job->sourceFile + ":") : String("Orphaned process:"))
+                        << '\n' << stdErr << (n ? n->stdOut : String());
+            }
+
+            if (n) {
+                assert(n->process == proc);
+                n->process = 0;
+                assert(!(n->job->flags & IndexerJob::Aborted));
+                if (!(n->job->flags & IndexerJob::Complete) && proc->returnCode() != 0) {
+                    auto nodeById = mActiveById.take(n->job->id);
+                    assert(nodeById);
+                    assert(nodeById == n);
+                    // job failed, probably no IndexDataMessage coming
+                    n->job->flags |= IndexerJob::Crashed;
+                    debug() << "job crashed" << n->job->id << n->job->fileId() << n->job.get();
+                    auto msg = std::make_shared<IndexDataMessage>(n->job);
+                    msg->setFlag(IndexDataMessage::ParseFailure);
+                    jobFinished(n->job, msg);
+                }
+            }
+            startJobs();
+        });
+    return process;
+}
+
+static size_t processMemoryUsage(Process *process)
+{
+#ifdef OS_Linux
+    FILE *f = fopen(String::format<64>("/proc/%d/statm", process->pid()).constData(), "r");
+    if (!f)
+        return 0;
+    unsigned long size, resident;
+    const int ret = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (ret == 2)
+        return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+#else
+    (void)process;
+#endif
+    return 0;
+}
+
+size_t JobScheduler::sampleMemory(Hash<Process*, size_t> *idleMemory)
+{
+    size_t ret = 0;
+    for (const auto &active : mActiveByProcess) {
+        Node *node = active.second.get();
+        node->peakMemory = std::max(node->peakMemory, processMemoryUsage(active.first));
+        ret += std::max(node->peakMemory, node->job->predictedMemory);
+    }
+    for (Process *process : mIdleProcesses) {
+        const size_t usage = processMemoryUsage(process);
+        if (idleMemory)
+            (*idleMemory)[process] = usage;
+        ret += usage;
+    }
+    return ret;
+}
+
+void JobScheduler::releaseProcess(Process *process)
+{
+    const auto &options = Server::instance()->options();
+    mActiveByProcess.remove(process);
+    const int jobs = ++mJobsByProcess[process];
+    if (jobs >= options.rpJobsPerProcess) {
+        debug() << "Retiring rp after" << jobs << "jobs";
+        process->closeStdIn(); // rp exits when it reads EOF between jobs
+        return;
+    }
+    if (options.rpMaxMemory > 0) {
+        const size_t usage = processMemoryUsage(process);
+        if (usage > static_cast<size_t>(options.rpMaxMemory) * 1024 * 1024) {
+            debug() << "Retiring rp using" << usage << "bytes after" << jobs << "jobs";
+            process->closeStdIn();
+            return;
+        }
+    }
+    mIdleProcesses.push_back(process);
+}
+
 void JobScheduler::handleIndexDataMessage(const std::shared_ptr<IndexDataMessage> &message)
 {
     auto node = mActiveById.take(message->id());
@@ -198,7 +307,26 @@ void JobScheduler::handleIndexDataMessage(const std::shared_ptr<IndexDataMessage
         return;
     }
     debug() << "job got index data message" << node->job->id << node->job->fileId() << node->job.get();
+    const uint32_t elapsed = static_cast<uint32_t>(Rct::monoMs() - node->started);
+    if (node->process)
+        node->peakMemory = std::max(node->peakMemory, processMemoryUsage(node->process));
+    if (std::shared_ptr<Project> project = Server::instance()->project(node->job->project)) {
+        project->recordIndexDuration(node->job->fileId(), elapsed);
+        if (node->peakMemory)
+            project->recordIndexMemory(node->job->fileId(), node->peakMemory);
+    }
+    mFinishedJobs.push_back({ node->job->sourceFile, node->job->predictedDuration, elapsed });
+    if (mFinishedJobs.size() > MaxFinishedJobs)
+        mFinishedJobs.pop_front();
+    Process *process = 0;
+    if (node->process && Server::instance()->options().rpJobsPerProcess > 1) {
+        process = node->process;
+        node->process = 0;
+        releaseProcess(process);
+    }
     jobFinished(node->job, message);
+    if (process)
+        startJobs();
 }
 
 void JobScheduler::jobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &message)
@@ -247,27 +375,42 @@ void JobScheduler::jobFinished(const std::shared_ptr<IndexerJob> &job, const std
 
 void JobScheduler::dump(const std::shared_ptr<Connection> &conn)
 {
+    conn->write<128>("Processes: %zu active, %zu idle, %zu started",
+                     mActiveByProcess.size(), mIdleProcesses.size(), mProcessesStarted);
+    const int budget = Server::instance()->options().jobMemoryBudget;
+    if (budget > 0) {
+        conn->write<128>("Memory: %zumb of %dmb committed, %zu jobs held back, throttled %zu times",
+                         sampleMemory() / (1024 * 1024), budget, mThrottledJobs, mThrottleCount);
+    }
     if (!mPendingJobs.isEmpty()) {
         conn->write("Pending:");
         for (const auto &node : mPendingJobs) {
-            conn->write<128>("%s: %s %s",
+            conn->write<128>("%s: %s %s predicted %ums",
                              node->job->sourceFile.constData(),
                              node->job->flags.toString().constData(),
-                             IndexerJob::dumpFlags(node->job->flags).constData());
+                             IndexerJob::dumpFlags(node->job->flags).constData(),
+                             node->job->predictedDuration);
         }
     }
     if (!mActiveById.isEmpty()) {
         conn->write("Active:");
         const unsigned long long now = Rct::monoMs();
         for (const auto &node : mActiveById) {
-            conn->write<128>("%s: %s %s %lldms",
+            conn->write<128>("%s: %s %s %lldms predicted %ums",
                              node.second->job->sourceFile.constData(),
                              node.second->job->flags.toString().constData(),
                              IndexerJob::dumpFlags(node.second->job->flags).constData(),
-                             now - node.second->started);
+                             now - node.second->started, node.second->job->predictedDuration);
 
         }
     }
+    if (!mFinishedJobs.isEmpty()) {
+        conn->write("Finished:");
+        for (const FinishedJob &job : mFinishedJobs) {
+            conn->write<128>("%s: predicted %ums actual %ums",
+                             job.sourceFile.constData(), job.predicted, job.actual);
+        }
+    }
 }
 
 void JobScheduler::abort(const std::shared_ptr<IndexerJob> &job)
@@ -310,7 +453,7 @@ void JobScheduler::sort()
     }
 
     std::stable_sort(nodes.begin(), nodes.end(), [](const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) -> bool {
-            return l->job->priority() > r->job->priority();
+            return runsBefore(*l->job, *r->job);
         });
 
     for (std::shared_ptr<Node> &n : nodes) {
@@ -21,14 +21,16 @@
 #include "rct/EmbeddedLinkedList.h"
 #include "rct/Set.h"
 #include "rct/Hash.h"
+#include "rct/LinkedList.h"
+#include "rct/Path.h"
 #include "rct/String.h"
+#include "rct/Timer.h"
 
 class Connection;
 class IndexDataMessage;
 class IndexerJob;
 class Process;
 class Project;
-struct DependencyNode;
 class JobScheduler : public std::enable_shared_from_this<JobScheduler>
 {
 public:
@@ -65,23 +67,40 @@ public:
     size_t activeJobCount() const { return mActiveById.size(); }
     void sort();
 private:
-    enum { HighPriority = 5 };
+    enum { HighPriority = 5, MaxFinishedJobs = 20, MemorySampleInterval = 1000 };
     void jobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &message);
+    Process *startProcess(int priority);
+    void releaseProcess(Process *process);
     struct Node {
         unsigned long long started;
         std::shared_ptr<IndexerJob> job;
         Process *process;
         std::shared_ptr<Node> next, prev;
         String stdOut;
+        size_t peakMemory;
+    };
+    // Updates the active jobs' peaks and returns the memory the rp processes
+    // use or are expected to use at their peak. The idle processes' share is
+    // broken down in idleMemory if passed.
+    size_t sampleMemory(Hash<Process*, size_t> *idleMemory = 0);
+    struct FinishedJob {
+        Path sourceFile;
+        uint32_t predicted, actual;
     };
-    uint32_t hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const;
     uint32_t hasHeaderError(uint32_t file, const std::shared_ptr<Project> &project) const;
 
     int mProcrastination;
     Set<uint32_t> mHeaderErrors;
+    LinkedList<FinishedJob> mFinishedJobs;
     EmbeddedLinkedList<std::shared_ptr<Node> > mPendingJobs;
     Hash<Process *, std::shared_ptr<Node> > mActiveByProcess;
     Hash<uint64_t, std::shared_ptr<Node> > mActiveById, mInactiveById;
+    // rp processes that stay alive between jobs when --rp-jobs-per-process > 1
+    LinkedList<Process *> mIdleProcesses;
+    Hash<Process *, int> mJobsByProcess;
+    size_t mProcessesStarted;
+    Timer mMemoryTimer;
+    size_t mThrottleCount, mThrottledJobs;
 };
 
 #endif
@@ -20,6 +20,7 @@
 #include "rct/List.h"
 #include "rct/Log.h"
 #include "RTags.h"
+#include "Sandbox.h"
 #include "Server.h"
 
 const Flags<QueryJob::JobFlag> defaultFlags = (QueryJob::WriteUnfiltered | QueryJob::QuietJob);
@@ -88,7 +89,10 @@ Set<String> ListSymbolsJob::listSymbolsWithPathFilter(const std::shared_ptr<Proj
     const bool wildcard = queryFlags() & QueryMessage::WildcardSymbolNames && (string.contains('*') || string.contains('?'));
     const bool stripParentheses = queryFlags() & QueryMessage::StripParentheses;
     const bool caseInsensitive = queryFlags() & QueryMessage::MatchCaseInsensitive;
+    const bool hasKindFilter = QueryJob::hasKindFilter();
     const String::CaseSensitivity cs = caseInsensitive ? String::CaseInsensitive : String::CaseSensitive;
+    // symbol names are stored encoded so match against the encoded query
+    const String encoded = Sandbox::encoded(string);
     for (size_t i=0; i<paths.size(); ++i) {
         const Path file = paths.at(i);
         const uint32_t fileId = Location::fileId(file);
@@ -99,23 +103,25 @@ Set<String> ListSymbolsJob::listSymbolsWithPathFilter(const std::shared_ptr<Proj
             continue;
         const int count = symbols->count();
         for (int j=0; j<count; ++j) {
-            const Symbol &symbol = symbols->valueAt(j);
-            if (!filterKind(symbol)) {
-                continue;
-            }
-            const String &symbolName = symbol.symbolName;
-            if (symbolName.isEmpty())
+            const SymbolView view = symbols->valueView<SymbolView>(j);
+            const StringView name = view.symbolName();
+            if (name.isEmpty())
                 continue;
-            if (!string.isEmpty()) {
+            if (!encoded.isEmpty()) {
                 if (wildcard) {
-                    if (!Project::matchSymbolName(string, symbolName, cs)) {
+                    if (!name.wildCmp(encoded.constData(), cs)) {
                         continue;
                     }
-                } else if (!symbolName.contains(string, cs)) {
+                } else if (!name.contains(encoded, cs)) {
                     continue;
                 }
             }
+            if (hasKindFilter && !filterKind(symbols->valueAt(j))) {
+                continue;
+            }
 
+            String symbolName = name.toString();
+            Sandbox::decode(symbolName);
             if (stripParentheses) {
                 const int paren = symbolName.indexOf('(');
                 if (paren == -1) {
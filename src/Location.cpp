@@ -15,6 +15,7 @@
 
 #include "Location.h"
 
+#include "rct/EventLoop.h"
 #include "rct/Rct.h"
 #include "RTags.h"
 #include "Server.h"
@@ -25,6 +26,8 @@ Hash<Path, uint32_t> Location::sPathsToIds;
 Hash<uint32_t, Path> Location::sIdsToPaths;
 uint32_t Location::sLastId = 0;
 std::mutex Location::sMutex;
+std::atomic<std::atomic<const Path*> *> Location::sPathChunks[PathChunkCount];
+static List<const Path*> sRetiredPaths; // kept until exit, see sPathChunks
 static inline uint64_t createMask(int startBit, int bitCount)
 {
     uint64_t mask = 0;
@@ -38,7 +41,14 @@ const uint64_t Location::FILEID_MASK = createMask(0, FileBits);
 const uint64_t Location::LINE_MASK = createMask(FileBits, LineBits);
 const uint64_t Location::COLUMN_MASK = createMask(FileBits + LineBits, ColumnBits);
 
-String Location::toString(Flags<ToStringFlag> flags, Hash<Path, String> *contextCache) const
+static inline std::shared_ptr<Project> currentProject()
+{
+    if (!Server::instance() || !EventLoop::isMainThread())
+        return std::shared_ptr<Project>();
+    return Server::instance()->currentProject();
+}
+
+String Location::toString(Flags<ToStringFlag> flags, Hash<Path, String> *contextCache, const Project *project) const
 {
     if (isNull())
         return String();
@@ -48,17 +58,21 @@ String Location::toString(Flags<ToStringFlag> flags, Hash<Path, String> *context
     String ctx;
     if (flags & Location::ShowContext) {
         ctx += '\t';
-        ctx += context(flags, contextCache);
+        ctx += context(flags, contextCache, project);
         extra += ctx.size();
     }
 
     Path p = path();
     if (flags & ConvertToRelative) {
         Sandbox::encode(p);
-    } else if (!(flags & AbsolutePath) && Server::instance()) {
-        Server *server = Server::instance();
-        if (std::shared_ptr<Project> pp = server->currentProject()) {
-            const Path projectPath = pp->path();
+    } else if (!(flags & AbsolutePath)) {
+        std::shared_ptr<Project> current;
+        if (!project) {
+            current = currentProject();
+            project = current.get();
+        }
+        if (project) {
+            const Path projectPath = project->path();
             if (!projectPath.isEmpty() && p.startsWith(projectPath))
                 p.remove(0, projectPath.size());
         }
@@ -73,20 +87,23 @@ String Location::toString(Flags<ToStringFlag> flags, Hash<Path, String> *context
     return ret;
 }
 
-String Location::context(Flags<ToStringFlag> flags, Hash<Path, String> *cache) const
+String Location::context(Flags<ToStringFlag> flags, Hash<Path, String> *cache, const Project *project) const
 {
     String copy;
     String *code = 0;
     const Path p = path();
 
-    auto readAll = [&p, this]() {
-        if (Server::instance()) {
-            if (auto project = Server::instance()->currentProject()) {
-                const Path f = project->sourceFilePath(fileId(), "unsaved");
-                String contents = f.readAll();
-                if (!contents.isEmpty())
-                    return contents;
-            }
+    std::shared_ptr<Project> current;
+    if (!project) {
+        current = currentProject();
+        project = current.get();
+    }
+    auto readAll = [&p, project, this]() {
+        if (project) {
+            const Path f = project->sourceFilePath(fileId(), "unsaved");
+            String contents = f.readAll();
+            if (!contents.isEmpty())
+                return contents;
         }
         return p.readAll();
     };
@@ -139,6 +156,46 @@ String Location::context(Flags<ToStringFlag> flags, Hash<Path, String> *cache) c
     return ret;
 }
 
+void Location::publishPath(uint32_t id, const Path &path)
+{
+    if (id >= (1u << FileBits))
+        return;
+    std::atomic<std::atomic<const Path*> *> &slot = sPathChunks[id >> PathChunkBits];
+    std::atomic<const Path*> *chunk = slot.load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new std::atomic<const Path*>[PathChunkSize];
+        for (int i=0; i<PathChunkSize; ++i)
+            chunk[i].store(0, std::memory_order_relaxed);
+        slot.store(chunk, std::memory_order_release);
+    }
+    std::atomic<const Path*> &entry = chunk[id & (PathChunkSize - 1)];
+    const Path *old = entry.load(std::memory_order_relaxed);
+    if (old && *old == path)
+        return;
+    entry.store(new Path(path), std::memory_order_release);
+    if (old) // a reader might still be copying it
+        sRetiredPaths.append(old);
+}
+
+void Location::republishPaths()
+{
+    for (int c=0; c<PathChunkCount; ++c) {
+        std::atomic<const Path*> *chunk = sPathChunks[c].load(std::memory_order_relaxed);
+        if (!chunk)
+            continue;
+        for (int i=0; i<PathChunkSize; ++i) {
+            const uint32_t id = (c << PathChunkBits) | i;
+            const Path *old = chunk[i].load(std::memory_order_relaxed);
+            if (old && !sIdsToPaths.contains(id)) {
+                chunk[i].store(0, std::memory_order_release);
+                sRetiredPaths.append(old);
+            }
+        }
+    }
+    for (const auto &it : sIdsToPaths)
+        publishPath(it.first, it.second);
+}
+
 void Location::saveFileIds()
 {
     assert(Server::instance());
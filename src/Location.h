@@ -25,6 +25,7 @@
 #elif defined(OS_Darwin)
 #include <sys/syslimits.h>
 #endif
+#include <atomic>
 #ifndef RTAGS_SINGLE_THREAD
 #include <mutex>
 #define LOCK() const std::lock_guard<std::mutex> lock(sMutex)
@@ -39,6 +40,8 @@
 #include "rct/String.h"
 #include "rct/StackBuffer.h"
 
+class Project;
+
 static inline int intCompare(uint32_t l, uint32_t r)
 {
     if (l < r)
@@ -74,10 +77,16 @@ public:
         LOCK();
         return sPathsToIds.value(path);
     }
+    // doesn't take the lock, see sPathChunks
     static inline Path path(uint32_t id)
     {
-        LOCK();
-        return sIdsToPaths.value(id);
+        if (id >= (1u << FileBits))
+            return Path();
+        const std::atomic<const Path*> *chunk = sPathChunks[id >> PathChunkBits].load(std::memory_order_acquire);
+        if (!chunk)
+            return Path();
+        const Path *path = chunk[id & (PathChunkSize - 1)].load(std::memory_order_acquire);
+        return path ? *path : Path();
     }
 
     static uint32_t lastId()
@@ -106,6 +115,7 @@ public:
             if (!id) {
                 id = ++sLastId;
                 sIdsToPaths[id] = path;
+                publishPath(id, path);
                 save = true;
             }
             ret = id;
@@ -123,8 +133,7 @@ public:
 
     inline Path path() const
     {
-        LOCK();
-        return sIdsToPaths.value(fileId());
+        return path(fileId());
     }
     inline bool isNull() const { return !value; }
     inline bool isValid() const { return value; }
@@ -169,8 +178,12 @@ public:
         ConvertToRelative = 0x8
     };
 
-    String toString(Flags<ToStringFlag> flags = NoFlag, Hash<Path, String> *contextCache = 0) const;
-    String context(Flags<ToStringFlag> flags, Hash<Path, String> *cache = 0) const;
+    // project is used to shorten paths and to find unsaved files. Without
+    // one the server's current project is used but only on the main thread.
+    String toString(Flags<ToStringFlag> flags = NoFlag, Hash<Path, String> *contextCache = 0,
+                    const Project *project = 0) const;
+    String context(Flags<ToStringFlag> flags, Hash<Path, String> *cache = 0,
+                   const Project *project = 0) const;
 
     inline String debug() const;
 
@@ -276,6 +289,7 @@ public:
             assert(!it.first.isEmpty());
             sLastId = std::max(sLastId, it.second);
         }
+        republishPaths();
     }
 
     static void init(const Hash<uint32_t, Path> &idsToPaths)
@@ -289,6 +303,7 @@ public:
             assert(!it.second.isEmpty());
             sLastId = std::max(sLastId, it.first);
         }
+        republishPaths();
     }
 
     static void set(const Path &path, uint32_t fileId)
@@ -296,11 +311,16 @@ public:
         LOCK();
         sPathsToIds[path] = fileId;
         Path &p = sIdsToPaths[fileId];
-        if (p.isEmpty())
+        if (p.isEmpty()) {
             p = path;
+            publishPath(fileId, path);
+        }
         sLastId = std::max(sLastId, fileId);
     }
 private:
+    // must be called with sMutex held
+    static void publishPath(uint32_t id, const Path &path);
+    static void republishPaths();
 #ifndef RTAGS_SINGLE_THREAD
     static std::mutex sMutex;
     static void saveFileIds();
@@ -313,6 +333,17 @@ private:
         LineBits = 21,
         ColumnBits = 64 - FileBits - LineBits
     };
+    enum {
+        PathChunkBits = 12,
+        PathChunkSize = 1 << PathChunkBits,
+        PathChunkCount = (1 << FileBits) >> PathChunkBits
+    };
+    // Append-only copy of sIdsToPaths so that path() never has to lock.
+    // Chunks and paths are published with release stores and are never
+    // freed. Paths replaced by init() are retired rather than deleted since a
+    // reader may still be copying them, that only happens when the file ids
+    // are reloaded so it's cheaper than tracking readers.
+    static std::atomic<std::atomic<const Path*> *> sPathChunks[PathChunkCount];
     static const uint64_t FILEID_MASK;
     static const uint64_t LINE_MASK;
     static const uint64_t COLUMN_MASK;
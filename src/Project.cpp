@@ -16,12 +16,17 @@
 #include "Project.h"
 
 #include <fnmatch.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
 #include <memory>
 #include <regex>
 
 #include "Diagnostic.h"
 #include "FileManager.h"
 #include "CompilerManager.h"
+#include "DependencyGraph.h"
 #include "IndexDataMessage.h"
 #include "JobScheduler.h"
 #include "LogOutputMessage.h"
@@ -32,6 +37,7 @@
 #include "rct/Rct.h"
 #include "rct/ReadLocker.h"
 #include "rct/Thread.h"
+#include "rct/ThreadPool.h"
 #include "rct/Value.h"
 #include "RTags.h"
 #include "RTagsLogOutput.h"
@@ -46,18 +52,63 @@ public:
     virtual ~Dirty() {}
     virtual Set<uint32_t> dirtied() const = 0;
     virtual bool isDirty(const SourceList &) = 0;
+    // Sources in toIndex that can wait until a few representatives have
+    // reindexed the modified files
+    virtual Set<uint32_t> deferred(const Set<uint32_t> &toIndex, size_t representatives) const
+    {
+        static_cast<void>(toIndex);
+        static_cast<void>(representatives);
+        return Set<uint32_t>();
+    }
 };
 
+// A header's FileMaps are written by whichever source gets to visit it
+// first so there's no need to wait for every dependent source. The ones
+// with open buffers and then the ones with the fewest includes go first.
+static Set<uint32_t> deferredSources(const std::shared_ptr<Project> &project,
+                                     const Hash<uint32_t, Set<uint32_t> > &dependents,
+                                     const Set<uint32_t> &toIndex, size_t count)
+{
+    Server *server = Server::instance();
+    const std::shared_ptr<const DependencyGraph> graph = project->dependencyGraph();
+    auto cost = [&graph, server](uint32_t fileId) -> size_t {
+        if (server->isActiveBuffer(fileId))
+            return 0;
+        if (!graph->contains(fileId))
+            return std::numeric_limits<size_t>::max();
+        return graph->edgeCount(fileId, DependencyGraph::Includes) + 1;
+    };
+    Set<uint32_t> representatives, candidates;
+    for (const auto &it : dependents) {
+        List<std::pair<size_t, uint32_t> > sources;
+        for (uint32_t dep : it.second) {
+            if (toIndex.contains(dep))
+                sources.append(std::make_pair(cost(dep), dep));
+        }
+        if (sources.size() > count) {
+            std::sort(sources.begin(), sources.end());
+            for (const auto &source : sources)
+                candidates.insert(source.second);
+        }
+        for (size_t i=0; i<sources.size(); ++i) {
+            if (i >= count && sources.at(i).first)
+                break;
+            representatives.insert(sources.at(i).second);
+        }
+    }
+    for (uint32_t fileId : representatives)
+        candidates.remove(fileId);
+    return candidates;
+}
+
 class SimpleDirty : public Dirty
 {
 public:
     void init(const std::shared_ptr<Project> &project, const Set<uint32_t> &dirty = Set<uint32_t>())
     {
         mProject = project;
-        for (auto fileId : dirty) {
-            mDirty.insert(fileId);
-            mDirty += project->dependencies(fileId, Project::DependsOnArg);
-        }
+        for (auto fileId : dirty)
+            insert(fileId);
     }
 
     virtual Set<uint32_t> dirtied() const override
@@ -67,8 +118,11 @@ public:
 
     void insert(uint32_t fileId)
     {
-        if (mDirty.insert(fileId))
-            mDirty += mProject->dependencies(fileId, Project::DependsOnArg);
+        if (mDirty.insert(fileId)) {
+            Set<uint32_t> &dependents = mDependents[fileId];
+            dependents = mProject->dependencies(fileId, Project::DependsOnArg);
+            mDirty += dependents;
+        }
     }
 
     virtual bool isDirty(const SourceList &sourceList) override
@@ -76,13 +130,22 @@ public:
         return mDirty.contains(sourceList.fileId());
     }
 
+    virtual Set<uint32_t> deferred(const Set<uint32_t> &toIndex, size_t representatives) const override
+    {
+        return deferredSources(mProject, mDependents, toIndex, representatives);
+    }
+
     Set<uint32_t> mDirty;
+    Hash<uint32_t, Set<uint32_t> > mDependents;
     std::shared_ptr<Project> mProject;
 };
 
 class ComplexDirty : public Dirty
 {
 public:
+    ComplexDirty(const std::shared_ptr<Project> &project = std::shared_ptr<Project>())
+        : mProject(project)
+    {}
     virtual Set<uint32_t> dirtied() const override
     {
         return mDirty;
@@ -91,6 +154,14 @@ public:
     {
         mDirty.insert(fileId);
     }
+    // seeds the caches with what Project::restore()'s threads found
+    void prime(uint32_t fileId, uint64_t lastModified, uint64_t hash)
+    {
+        if (lastModified)
+            mLastModified[fileId] = lastModified;
+        if (hash)
+            mContentHashes[fileId] = hash;
+    }
     inline uint64_t lastModified(uint32_t fileId)
     {
         uint64_t &time = mLastModified[fileId];
@@ -100,7 +171,33 @@ public:
         return time;
     }
 
-    Hash<uint32_t, uint64_t> mLastModified;
+    // A newer mtime than time only counts if the contents differ from what
+    // was indexed. Checkouts and code generators touch a lot of files
+    // without changing them.
+    bool modifiedSince(uint32_t fileId, uint64_t time)
+    {
+        const uint64_t modified = lastModified(fileId);
+        if (!modified)
+            return true; // gone
+        if (modified <= time)
+            return false;
+        const DependencyNode *node = mProject ? mProject->dependencyNode(fileId) : 0;
+        if (!node || !node->contentHash || node->contentModified > time)
+            return true;
+        if (node->contentVerified == modified)
+            return false;
+        uint64_t &hash = mContentHashes[fileId];
+        if (!hash) {
+            hash = RTags::contentHash(Location::path(fileId).readAll());
+        }
+        if (hash != node->contentHash)
+            return true;
+        mProject->setContentVerified(fileId, modified);
+        return false;
+    }
+
+    std::shared_ptr<Project> mProject;
+    Hash<uint32_t, uint64_t> mLastModified, mContentHashes;
     Set<uint32_t> mDirty;
 };
 
@@ -117,7 +214,7 @@ class IfModifiedDirty : public ComplexDirty
 {
 public:
     IfModifiedDirty(const std::shared_ptr<Project> &project, const Match &match = Match())
-        : mProject(project), mMatch(match)
+        : ComplexDirty(project), mMatch(match)
     {
     }
 
@@ -128,8 +225,7 @@ public:
         const uint32_t fileId = sourceList.fileId();
         if (mMatch.isEmpty() || mMatch.match(Location::path(fileId))) {
             for (auto it : mProject->dependencies(fileId, Project::ArgDependsOn)) {
-                uint64_t depLastModified = lastModified(it);
-                if (!depLastModified || depLastModified > sourceList.parsed) {
+                if (modifiedSince(it, sourceList.parsed)) {
                     ret = true;
                     insertDirtyFile(it);
                 }
@@ -142,7 +238,6 @@ public:
         return ret;
     }
 
-    std::shared_ptr<Project> mProject;
     Match mMatch;
 };
 
@@ -151,6 +246,7 @@ class WatcherDirty : public ComplexDirty
 {
 public:
     WatcherDirty(const std::shared_ptr<Project> &project, const Set<uint32_t> &modified)
+        : ComplexDirty(project)
     {
         for (auto it : modified) {
             mModified[it] = project->dependencies(it, Project::DependsOnArg);
@@ -164,9 +260,8 @@ public:
         for (auto it : mModified) {
             const auto &deps = it.second;
             if (deps.contains(sourceList.fileId())) {
-                const uint64_t depLastModified = lastModified(it.first);
-                if (!depLastModified || depLastModified > sourceList.parsed) {
-                    // dependency is gone
+                if (modifiedSince(it.first, sourceList.parsed)) {
+                    // dependency is gone or modified
                     ret = true;
                     insertDirtyFile(it.first);
                 }
@@ -178,6 +273,11 @@ public:
         return ret;
     }
 
+    virtual Set<uint32_t> deferred(const Set<uint32_t> &toIndex, size_t representatives) const override
+    {
+        return deferredSources(mProject, mModified, toIndex, representatives);
+    }
+
     Hash<uint32_t, Set<uint32_t> > mModified;
 };
 
@@ -202,7 +302,7 @@ static Project::DependencyMode modeForSymbol(const Symbol &symbol)
     return mode;
 }
 
-static bool loadDependencies(DataFile &file, Dependencies &dependencies)
+static bool loadDependencies(DataFile &file, Dependencies &dependencies, DependencyGraph::Rows &includes)
 {
     int size;
     file >> size;
@@ -213,7 +313,10 @@ static bool loadDependencies(DataFile &file, Dependencies &dependencies)
             return false;
         Flags<DependencyNode::Flag> flags;
         file >> flags;
-        dependencies[fileId] = new DependencyNode(fileId, flags);
+        DependencyNode *node = new DependencyNode(fileId, flags);
+        file >> node->contentHash >> node->contentModified >> node->contentVerified;
+        dependencies[fileId] = node;
+        includes[fileId];
     }
     for (int i=0; i<size; ++i) {
         int links;
@@ -221,36 +324,36 @@ static bool loadDependencies(DataFile &file, Dependencies &dependencies)
         if (links) {
             uint32_t dependee;
             file >> dependee;
-            DependencyNode *ee = dependencies[dependee];
-            if (!ee) {
+            if (!dependencies.contains(dependee)) {
                 return false;
             }
             while (links--) {
                 uint32_t dependent;
                 file >> dependent;
-                DependencyNode *ent = dependencies[dependent];
-                if (!ent) {
+                if (!dependencies.contains(dependent)) {
                     return false;
                 }
-                ent->include(ee);
+                includes[dependent].append(dependee);
             }
         }
     }
     return true;
 }
 
-static void saveDependencies(DataFile &file, const Dependencies &dependencies)
+static void saveDependencies(DataFile &file, const Dependencies &dependencies, const DependencyGraph &graph)
 {
     file << static_cast<int>(dependencies.size());
     for (const auto &it : dependencies) {
-        file << it.first << it.second->flags;
+        file << it.first << it.second->flags << it.second->contentHash << it.second->contentModified
+             << it.second->contentVerified;
     }
     for (const auto &it : dependencies) {
-        file << static_cast<int>(it.second->dependents.size());
-        if (!it.second->dependents.isEmpty()) {
+        const List<uint32_t> dependents = graph.edges(it.first, DependencyGraph::Dependents);
+        file << static_cast<int>(dependents.size());
+        if (!dependents.isEmpty()) {
             file << it.first;
-            for (const auto &dep : it.second->dependents) {
-                file << dep.first;
+            for (uint32_t dep : dependents) {
+                file << dep;
             }
         }
     }
@@ -258,7 +361,8 @@ static void saveDependencies(DataFile &file, const Dependencies &dependencies)
 
 Project::Project(const Path &path)
     : mPath(path), mSourceFilePathBase(RTags::encodeSourceFilePath(Server::instance()->options().dataDir, path)),
-      mJobCounter(0), mJobsStarted(0), mBytesWritten(0), mSaveDirty(false)
+      mJobCounter(0), mJobsStarted(0), mFileIdIndexKeysSize(0), mBytesWritten(0), mIndexDurationTotal(0), mIndexMemoryTotal(0), mSaveDirty(false), mJournal(0), mJournalGeneration(0),
+      mJournalSize(0), mCompactedSize(0), mJournalCompact(false), mIsSnapshot(false)
 {
     Path srcPath = mPath;
     RTags::encodePath(srcPath);
@@ -266,12 +370,21 @@ Project::Project(const Path &path)
     const Path tmp = options.dataDir + srcPath;
     mProjectFilePath = tmp + "/project";
     mSourcesFilePath = tmp + "/sources";
+    mBloomFilterCache = std::make_shared<BloomFilterCache>(MaxBloomFilterMemory);
+    if (options.maxFileMapCacheMemory > 0)
+        mFileMapCache = std::make_shared<FileMapCache>(static_cast<size_t>(options.maxFileMapCacheMemory) * 1024 * 1024,
+                                                       options.maxFileMapScopeCacheSize);
 }
 
 Project::~Project()
 {
+    if (mIsSnapshot) {
+        mDependencies.deleteAll();
+        return;
+    }
     if (mSaveDirty)
         save();
+    closeJournal();
     for (const auto &job : mActiveJobs) {
         assert(job.second);
         Server::instance()->jobScheduler()->abort(job.second);
@@ -283,26 +396,17 @@ Project::~Project()
     mReloadCompileCommandsTimer.stop();
 }
 
-static bool hasSourceDependency(const DependencyNode *node, const std::shared_ptr<Project> &project, Set<uint32_t> &seen)
+static bool hasSourceDependency(const DependencyNode *node, const std::shared_ptr<Project> &project)
 {
-    const Path path = Location::path(node->fileId);
-    // error("%s %d %d", path.constData(), path.isFile(), path.isSource());
-    if (path.isFile() && path.isSource() && project->hasSource(node->fileId)) {
-        return true;
-    }
-    for (auto it : node->dependents) {
-        if (seen.insert(it.first) && hasSourceDependency(it.second, project, seen))
+    for (uint32_t fileId : *project->dependencyGraph()->closure(node->fileId, DependencyGraph::Dependents)) {
+        const Path path = Location::path(fileId);
+        // error("%s %d %d", path.constData(), path.isFile(), path.isSource());
+        if (path.isFile() && path.isSource() && project->hasSource(fileId))
             return true;
     }
     return false;
 }
 
-static inline bool hasSourceDependency(const DependencyNode *node, const std::shared_ptr<Project> &project)
-{
-    Set<uint32_t> seen;
-    return hasSourceDependency(node, project, seen);
-}
-
 bool Project::readSources(const Path &path, IndexParseData &data, String *err)
 {
     DataFile file(path, RTags::SourcesFileVersion);
@@ -317,9 +421,11 @@ bool Project::readSources(const Path &path, IndexParseData &data, String *err)
 
     if (Sandbox::hasRoot()) {
         forEachSource(data, [](Source &source) {
-                for (String &arg : source.arguments) {
+                List<String> arguments = source.arguments;
+                for (String &arg : arguments) {
                     arg = Sandbox::decoded(arg);
                 }
+                source.arguments = arguments;
                 return Continue;
             });
     }
@@ -328,6 +434,7 @@ bool Project::readSources(const Path &path, IndexParseData &data, String *err)
 
 bool Project::init()
 {
+    invalidateSnapshot();
     const JobScheduler::JobScope scope(Server::instance()->jobScheduler());
     const Server::Options &options = Server::instance()->options();
     if (!(options.options & Server::NoFileSystemWatch)) {
@@ -384,7 +491,15 @@ bool Project::init()
     for (const auto &info : mIndexParseData.compileCommands)
         watch(Location::path(info.first), Watch_CompileCommands);
 
-    if (!loadDependencies(file, mDependencies)) {
+    DependencyGraph::Rows includes;
+    const bool loaded = loadDependencies(file, mDependencies, includes);
+    {
+        std::lock_guard<std::mutex> lock(mDependencyGraphMutex);
+        mDependencyGraphIncludes.clear();
+        mDependencyGraphRemoved.clear();
+        mDependencyGraph = std::make_shared<DependencyGraph>(loaded ? includes : DependencyGraph::Rows());
+    }
+    if (!loaded) {
         mDependencies.deleteAll();
         mVisitedFiles.clear();
         mDiagnostics.clear();
@@ -392,12 +507,159 @@ bool Project::init()
         reindexAll();
         return true;
     }
+    file >> mFileIdIndexDirty >> mIndexDurations >> mIndexMemory >> mJournalGeneration;
+    mCompactedSize = mProjectFilePath.fileSize() + mSourcesFilePath.fileSize();
+    if (replayJournal())
+        openJournal(false);
+    clearJournal();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJournalVisited.clear();
+    }
+    for (const auto &duration : mIndexDurations)
+        mIndexDurationTotal += duration.second;
+    for (const auto &memory : mIndexMemory)
+        mIndexMemoryTotal += memory.second;
 
     for (const auto &dep : mDependencies) {
         watchFile(dep.first);
     }
 
-    bool needsSave = false;
+    mRestore = std::make_shared<Restore>();
+    if (!loadFileIdIndexes()) {
+        for (const auto &dep : mDependencies)
+            mFileIdIndexDirty.insert(dep.first);
+        mRestore->needsSave = true;
+    }
+    return true;
+}
+
+enum { RestoreChunkSize = 256 };
+
+struct Project::RestoreFile
+{
+    uint32_t fileId;
+    Path path, fileMaps; // fileMaps is empty for sources that aren't dependencies
+    uint64_t contentHash, contentModified, contentVerified;
+    uint64_t lastModified, hash; // filled in by RestoreJob, 0 for missing files
+    bool valid;
+    String error;
+    bool readKeys; // fileMaps is a dirty file's container, keys is filled in by RestoreJob
+    std::shared_ptr<const FileIdIndexKeys> keys;
+};
+
+struct Project::Restore
+{
+    Restore()
+        : needsSave(false), pending(0)
+    {}
+
+    bool needsSave;
+    size_t pending;
+    List<RestoreFile> files;
+    Set<uint32_t> rewritten; // by jobs that finished while restoring, their keys are newer
+    StopWatch timer;
+};
+
+class Project::RestoreJob : public ThreadPool::Job
+{
+public:
+    typedef void (Project::*Callback)(List<RestoreFile> &&);
+    RestoreJob(const std::shared_ptr<Project> &project, List<RestoreFile> &&files, ValidateMode mode,
+               Callback callback = &Project::onRestored)
+        : mProject(project), mFiles(std::make_shared<List<RestoreFile> >(std::move(files))), mMode(mode), mCallback(callback)
+    {}
+protected:
+    virtual void run() override
+    {
+        for (RestoreFile &file : *mFiles) {
+            file.lastModified = file.path.isFile() ? file.path.lastModifiedMs() : 0;
+            if (!file.lastModified)
+                continue;
+            // what ComplexDirty::modifiedSince() would have to read anyway
+            if (file.contentHash && file.lastModified > file.contentModified && file.lastModified != file.contentVerified)
+                file.hash = RTags::contentHash(file.path.readAll());
+            if (!file.fileMaps.isEmpty())
+                file.valid = Project::validate(file.fileMaps, file.fileId, mMode, &file.error);
+            if (file.readKeys && file.valid)
+                file.keys = Project::readFileIdIndexKeys(file.fileMaps);
+        }
+        // the project can only be touched, and destroyed, on the main thread
+        std::weak_ptr<Project> weak = mProject;
+        std::shared_ptr<List<RestoreFile> > files = mFiles;
+        const Callback callback = mCallback;
+        EventLoop::mainEventLoop()->callLater([weak, files, callback]() {
+                if (std::shared_ptr<Project> project = weak.lock())
+                    (project.get()->*callback)(std::move(*files));
+            });
+    }
+private:
+    const std::weak_ptr<Project> mProject;
+    std::shared_ptr<List<RestoreFile> > mFiles;
+    const ValidateMode mMode;
+    const Callback mCallback;
+};
+
+void Project::restore()
+{
+    assert(EventLoop::isMainThread());
+    if (!mRestore || mRestore->pending)
+        return;
+
+    const std::shared_ptr<Project> project = shared_from_this();
+    const std::shared_ptr<ThreadPool> pool = Server::instance()->restoreThreadPool();
+    const ValidateMode mode = Server::instance()->options().options & Server::ValidateFileMaps ? Validate : StatOnly;
+    List<RestoreFile> chunk;
+    size_t count = 0;
+    auto start = [&]() {
+        ++mRestore->pending;
+        pool->start(std::make_shared<RestoreJob>(project, std::move(chunk), mode));
+        chunk.clear();
+    };
+    // without indexes every file is dirty and compaction reads them anyway
+    const bool readKeys = mSymbolNameIndex != 0;
+    auto add = [&](uint32_t fileId, const Path &fileMaps, const DependencyNode *node) {
+        chunk.append(RestoreFile { fileId, Location::path(fileId), fileMaps,
+                                   node ? node->contentHash : 0, node ? node->contentModified : 0, node ? node->contentVerified : 0,
+                                   0, 0, true, String(), readKeys && node && mFileIdIndexDirty.contains(fileId),
+                                   std::shared_ptr<const FileIdIndexKeys>() });
+        ++count;
+        if (chunk.size() == RestoreChunkSize)
+            start();
+    };
+    for (const auto &dep : mDependencies)
+        add(dep.first, sourceFilePath(dep.first, FileMapContainer::fileName()), dep.second);
+    forEachSourceList([this, &add](const SourceList &src) -> VisitResult {
+            if (!mDependencies.contains(src.fileId()))
+                add(src.fileId(), Path(), 0);
+            return Continue;
+        });
+    if (!chunk.isEmpty())
+        start();
+
+    if (count >= 100)
+        logDirect(LogLevel::Error, String::format<128>("Restoring %s (%zu files)\n", mPath.constData(), count), LogOutput::StdOut);
+    if (!mRestore->pending)
+        finishRestore();
+}
+
+void Project::onRestored(List<RestoreFile> &&files)
+{
+    if (!mRestore)
+        return;
+    for (RestoreFile &file : files)
+        mRestore->files.append(std::move(file));
+    if (!--mRestore->pending)
+        finishRestore();
+}
+
+void Project::finishRestore()
+{
+    invalidateSnapshot();
+    const JobScheduler::JobScope scope(Server::instance()->jobScheduler());
+    const std::shared_ptr<Restore> restore = std::move(mRestore);
+    bool needsSave = restore->needsSave;
+
     std::unique_ptr<ComplexDirty> dirty;
 
     if (Server::instance()->suspended()) {
@@ -406,67 +668,57 @@ bool Project::init()
         dirty.reset(new IfModifiedDirty(shared_from_this()));
     }
 
-    Set<uint32_t> missingFileMaps;
+    // dependencies and sources may have changed while the restore threads
+    // were running, only what's still around counts
+    Set<uint32_t> missingFileMaps, missingFiles;
     {
         List<uint32_t> removed;
-        int idx = 0;
-        bool outputDirty = false;
-        if (mDependencies.size() >= 100) {
-            logDirect(LogLevel::Error, String::format<128>("Restoring %s ", mPath.constData()), LogOutput::StdOut);
-            outputDirty = true;
-        }
         const std::shared_ptr<Project> project = shared_from_this();
-        for (auto it : mDependencies) {
-            const Path path = Location::path(it.first);
-            if (!path.isFile()) {
-                warning() << path << "seems to have disappeared";
-                dirty.get()->insertDirtyFile(it.first);
+        for (const RestoreFile &file : restore->files) {
+            dirty->prime(file.fileId, file.lastModified, file.hash);
+            if (!file.lastModified)
+                missingFiles.insert(file.fileId);
+            if (file.fileMaps.isEmpty())
+                continue;
+            const DependencyNode *node = mDependencies.value(file.fileId);
+            if (!node)
+                continue;
+            if (file.keys && mFileIdIndexDirty.contains(file.fileId) && !restore->rewritten.contains(file.fileId))
+                setFileIdIndexKeys(file.fileId, file.keys);
+            if (!file.lastModified) {
+                warning() << file.path << "seems to have disappeared";
+                dirty.get()->insertDirtyFile(file.fileId);
 
-                const Set<uint32_t> dependents = dependencies(it.first, DependsOnArg);
+                const Set<uint32_t> dependents = dependencies(file.fileId, DependsOnArg);
                 for (auto dependent : dependents) {
                     dirty.get()->insertDirtyFile(dependent);
                 }
-                removed << it.first;
+                removed << file.fileId;
                 needsSave = true;
-            } else {
-                String errorString;
-                if (!validate(it.first,  options.options & Server::ValidateFileMaps ? Validate : StatOnly, &errorString)) {
-                    if (!errorString.isEmpty()) {
-                        if (outputDirty) {
-                            outputDirty = false;
-                            logDirect(LogLevel::Error, String("\n"), LogOutput::StdOut);
-                        }
-                        error() << errorString;
-                    }
-                    if (hasSource(it.first) || hasSourceDependency(it.second, project)) {
-                        missingFileMaps.insert(it.first);
-                    } else {
-                        removed << it.first;
-                        needsSave = true;
-                    }
+            } else if (!file.valid) {
+                if (!file.error.isEmpty())
+                    error() << file.error;
+                if (hasSource(file.fileId) || hasSourceDependency(node, project)) {
+                    missingFileMaps.insert(file.fileId);
+                } else {
+                    removed << file.fileId;
+                    needsSave = true;
                 }
             }
-            if (++idx % 100 == 0) {
-                outputDirty = true;
-                logDirect(LogLevel::Error, ".", 1, LogOutput::StdOut);
-                // error("%d/%d (%.2f%%)", idx, count, (idx / static_cast<double>(count)) * 100.0);
-            }
         }
-        if (outputDirty)
-            logDirect(LogLevel::Error, "\n", 1, LogOutput::StdOut);
         for (uint32_t r : removed) {
             removeDependencies(r);
         }
     }
 
-    forEachSourceList([&dirty, this, &needsSave](SourceList &src) -> VisitResult {
+    forEachSourceList([&dirty, &missingFiles, this, &needsSave](SourceList &src) -> VisitResult {
             uint32_t fileId = src.fileId();
-            const Path sourceFile = Location::path(fileId);
-            if (!sourceFile.isFile()) {
-                warning() << sourceFile << "seems to have disappeared";
+            if (missingFiles.contains(fileId)) {
+                warning() << Location::path(fileId) << "seems to have disappeared";
                 removeDependencies(fileId);
                 dirty.get()->insertDirtyFile(fileId);
                 needsSave = true;
+                mJournalCompact = true;
                 return Remove;
             }
             watchFile(fileId);
@@ -484,7 +736,11 @@ bool Project::init()
         simple.init(shared_from_this(), missingFileMaps);
         startDirtyJobs(&simple, IndexerJob::Dirty);
     }
-    return true;
+    if (restore->files.size() >= 100) {
+        logDirect(LogLevel::Error, String::format<128>("Restored %s in %llums\n", mPath.constData(),
+                                                       static_cast<unsigned long long>(restore->timer.elapsed())),
+                  LogOutput::StdOut);
+    }
 }
 
 bool Project::match(const Match &p, bool *indexed) const
@@ -676,6 +932,7 @@ static String formatDiagnostics(const Diagnostics &diagnostics, Flags<QueryMessa
 
 void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &msg)
 {
+    invalidateSnapshot();
     mBytesWritten += msg->bytesWritten();
     std::shared_ptr<IndexerJob> restart;
     const uint32_t fileId = job->fileId();
@@ -688,6 +945,11 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
         return;
     }
 
+    if (mFileMapCache) {
+        for (uint32_t file : msg->changedFiles())
+            mFileMapCache->remove(file);
+    }
+
     const bool success = job->flags & IndexerJob::Complete;
     assert(!(job->flags & IndexerJob::Aborted));
     assert(((job->flags & (IndexerJob::Complete|IndexerJob::Crashed)) == IndexerJob::Complete)
@@ -703,13 +965,17 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
         return;
     }
     if (!(msg->flags() & IndexDataMessage::ParseFailure)) {
+        // Loading every visited file's FileMaps here would make finishing a
+        // job as expensive as its include set. Check them against the sizes
+        // rp wrote and leave the rest to the verifier.
         for (uint32_t file : job->visited) {
-            if (!validate(file, Validate)) {
+            if (!validate(file, StatOnly, 0, msg->fileMapSizes().value(file))) {
                 releaseFileIds(job->visited);
                 dirty(fileId);
                 return;
             }
         }
+        verifyFileMaps(fileId, job->visited);
     }
 
     const int idx = mJobCounter - mActiveJobs.size();
@@ -746,6 +1012,16 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
     updateFixIts(visited, msg->fixIts());
     updateDependencies(fileId, msg);
     if (success) {
+        // files whose FileMaps weren't rewritten keep their index entries and bloom filters
+        const Set<uint32_t> changed = msg->changedFiles();
+        mFileIdIndexDirty.unite(changed);
+        mJournalFileIdIndexDirty.unite(changed);
+        for (uint32_t file : changed) {
+            mBloomFilterCache->remove(file);
+            setFileIdIndexKeys(file, readFileIdIndexKeys(sourceFilePath(file, FileMapContainer::fileName())));
+        }
+        if (mRestore)
+            mRestore->rewritten.unite(changed);
         forEachSources([&msg, fileId](Sources &sources) -> VisitResult {
                 // error() << "finished with" << Location::path(fileId) << sources.contains(fileId) << msg->parseTime();
                 if (sources.contains(fileId)) {
@@ -753,6 +1029,7 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
                 }
                 return Continue;
             });
+        mJournalParsed[fileId] = msg->parseTime();
         logDirect(LogLevel::Error, String::format("[%3d%%] %d/%d %s %s. (%s)",
                                                   static_cast<int>(round((double(idx) / double(mJobCounter)) * 100.0)), idx, mJobCounter,
                                                   String::formatTime(time(0), String::Time).constData(),
@@ -823,8 +1100,20 @@ String Project::diagnosticsToString(Flags<QueryMessage::Flag> flags, uint32_t fi
     return formatDiagnostics(mDiagnostics, flags, fileId);
 }
 
+enum { MinJournalCompactionSize = 1024 * 1024 };
+
 bool Project::save()
 {
+    const bool compactFileIdIndexes = !mSymbolNameIndex || mFileIdIndexKeysSize > MaxFileIdIndexKeysMemory
+                                      || mFileIdIndexDirty.size() >= std::max<size_t>(256, mDependencies.size() / 10);
+    if (mJournal && !mJournalCompact && !compactFileIdIndexes
+        && mJournalSize < std::max<size_t>(MinJournalCompactionSize, mCompactedSize / 2)) {
+        if (appendJournal()) {
+            mSaveDirty = false;
+            return true;
+        }
+    }
+    closeJournal();
     Path::mkdir(mSourcesFilePath.parentDir(), Path::Recursive);
     {
         DataFile file(mSourcesFilePath, RTags::SourcesFileVersion);
@@ -847,18 +1136,318 @@ bool Project::save()
             } else {
                 file << mVisitedFiles;
             }
+            mJournalVisited.clear();
         }
         file << mDiagnostics;
-        saveDependencies(file, mDependencies);
+        saveDependencies(file, mDependencies, *dependencyGraph());
+        if (compactFileIdIndexes) {
+            if (!saveFileIdIndexes())
+                error("Save error %s: Failed to write file id indexes", mPath.constData());
+        }
+        mJournalGeneration = std::max<uint64_t>(Rct::currentTimeMs(), mJournalGeneration + 1);
+        file << mFileIdIndexDirty << mIndexDurations << mIndexMemory << mJournalGeneration;
         if (!file.flush()) {
             error("Save error %s: %s", mProjectFilePath.constData(), file.error().constData());
             return false;
         }
     }
+    mCompactedSize = mProjectFilePath.fileSize() + mSourcesFilePath.fileSize();
+    clearJournal();
+    // project is complete now so the journal starts over
+    openJournal(true);
     mSaveDirty = false;
     return true;
 }
 
+bool Project::appendJournal()
+{
+    assert(mJournal);
+    String record;
+    {
+        Serializer serializer(record);
+        Hash<uint32_t, Path> visited;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (uint32_t fileId : mJournalVisited)
+                visited[fileId] = mVisitedFiles.value(fileId); // empty means released
+            mJournalVisited.clear();
+        }
+        if (Sandbox::hasRoot()) {
+            serializer << Sandbox::encoded(visited);
+        } else {
+            serializer << visited;
+        }
+
+        const std::shared_ptr<const DependencyGraph> graph = dependencyGraph();
+        serializer << static_cast<uint32_t>(mJournalDependencies.size());
+        for (uint32_t fileId : mJournalDependencies) {
+            const DependencyNode *node = mDependencies.value(fileId);
+            serializer << fileId << (node != 0);
+            if (node) {
+                const List<uint32_t> includes = graph->edges(fileId, DependencyGraph::Includes);
+                serializer << node->flags << node->contentHash << node->contentModified << node->contentVerified
+                           << static_cast<uint32_t>(includes.size());
+                for (uint32_t inc : includes)
+                    serializer << inc;
+            }
+        }
+
+        Diagnostics diagnostics;
+        for (uint32_t fileId : mJournalDiagnostics) {
+            auto it = mDiagnostics.lower_bound(Location(fileId, 0, 0));
+            while (it != mDiagnostics.end() && it->first.fileId() == fileId)
+                diagnostics.insert(*it++);
+        }
+
+        Hash<uint32_t, uint32_t> durations, memory; // 0 means removed
+        for (uint32_t fileId : mJournalTimings) {
+            durations[fileId] = mIndexDurations.value(fileId);
+            memory[fileId] = mIndexMemory.value(fileId);
+        }
+        serializer << mJournalDiagnostics << diagnostics << mJournalParsed << mJournalFileIdIndexDirty << durations << memory;
+    }
+
+    const uint32_t size = record.size();
+    const uint64_t checksum = RTags::contentHash(record);
+    if (!fwrite(&size, sizeof(size), 1, mJournal)
+        || !fwrite(&checksum, sizeof(checksum), 1, mJournal)
+        || !fwrite(record.constData(), size, 1, mJournal)
+        || fflush(mJournal)) {
+        error("Save error %s: Can't append to journal: %s", mProjectFilePath.constData(), Rct::strerror().constData());
+        return false;
+    }
+    mJournalSize += sizeof(size) + sizeof(checksum) + size;
+    clearJournal();
+    return true;
+}
+
+bool Project::replayJournal()
+{
+    const String journal = Path(mProjectFilePath + ".journal").readAll();
+    int version;
+    uint64_t generation;
+    if (journal.size() < sizeof(version) + sizeof(generation))
+        return false;
+    memcpy(&version, journal.constData(), sizeof(version));
+    memcpy(&generation, journal.constData() + sizeof(version), sizeof(generation));
+    if (version != RTags::DatabaseVersion || generation != mJournalGeneration)
+        return false;
+
+    // A truncated record at the end means we crashed while appending it.
+    // Everything from the first bad record on is dropped, the records
+    // before it still add up to a consistent project.
+    size_t pos = sizeof(version) + sizeof(generation);
+    int records = 0;
+    uint32_t size;
+    uint64_t checksum;
+    while (pos + sizeof(size) + sizeof(checksum) <= journal.size()) {
+        memcpy(&size, journal.constData() + pos, sizeof(size));
+        memcpy(&checksum, journal.constData() + pos + sizeof(size), sizeof(checksum));
+        const size_t header = sizeof(size) + sizeof(checksum);
+        if (pos + header + size > journal.size())
+            break;
+        const String record = journal.mid(pos + header, size);
+        if (RTags::contentHash(record) != checksum) {
+            error("Restore error %s: Journal record %d is corrupted", mPath.constData(), records + 1);
+            break;
+        }
+        // decode all of it first, a record is applied completely or not at all
+        Deserializer deserializer(record);
+        Hash<uint32_t, Path> visited;
+        deserializer >> visited;
+        struct JournalNode {
+            uint32_t fileId;
+            bool exists;
+            Flags<DependencyNode::Flag> flags;
+            uint64_t contentHash, contentModified, contentVerified;
+            List<uint32_t> includes;
+        };
+        List<JournalNode> nodes;
+        uint32_t count;
+        deserializer >> count;
+        bool valid = count <= size; // every node takes at least a byte
+        if (valid)
+            nodes.resize(count);
+        for (JournalNode &node : nodes) {
+            deserializer >> node.fileId >> node.exists;
+            if (node.exists) {
+                uint32_t includes;
+                deserializer >> node.flags >> node.contentHash >> node.contentModified >> node.contentVerified >> includes;
+                if (includes > size) {
+                    valid = false;
+                    break;
+                }
+                node.includes.resize(includes);
+                for (uint32_t &include : node.includes)
+                    deserializer >> include;
+            }
+        }
+        Set<uint32_t> diagnosticFiles;
+        Diagnostics diagnostics;
+        Hash<uint32_t, uint64_t> parsed;
+        Hash<uint32_t, uint32_t> durations, memory;
+        Set<uint32_t> fileIdIndexDirty;
+        deserializer >> diagnosticFiles >> diagnostics >> parsed >> fileIdIndexDirty >> durations >> memory;
+        if (!valid || !deserializer.atEnd()) {
+            error("Restore error %s: Journal record %d doesn't decode", mPath.constData(), records + 1);
+            break;
+        }
+        pos += header + size;
+        ++records;
+
+        Sandbox::decode(visited);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (const auto &it : visited) {
+                if (it.second.isEmpty()) {
+                    mVisitedFiles.remove(it.first);
+                } else {
+                    mVisitedFiles[it.first] = it.second;
+                }
+            }
+        }
+
+        for (JournalNode &journalNode : nodes) {
+            const uint32_t fileId = journalNode.fileId;
+            DependencyNode *node = mDependencies.value(fileId);
+            if (!journalNode.exists) {
+                if (node) {
+                    mDependencies.remove(fileId);
+                    removeFromDependencyGraph(fileId);
+                    delete node;
+                }
+                continue;
+            }
+            if (!node) {
+                node = new DependencyNode(fileId);
+                mDependencies[fileId] = node;
+            }
+            node->flags = journalNode.flags;
+            node->contentHash = journalNode.contentHash;
+            node->contentModified = journalNode.contentModified;
+            node->contentVerified = journalNode.contentVerified;
+            for (uint32_t include : journalNode.includes) {
+                DependencyNode *&inc = mDependencies[include];
+                if (!inc)
+                    inc = new DependencyNode(include);
+            }
+            setIncludes(fileId, std::move(journalNode.includes));
+        }
+
+        mFileIdIndexDirty.unite(fileIdIndexDirty);
+        for (uint32_t fileId : diagnosticFiles) {
+            auto it = mDiagnostics.lower_bound(Location(fileId, 0, 0));
+            while (it != mDiagnostics.end() && it->first.fileId() == fileId)
+                mDiagnostics.erase(it++);
+        }
+        for (const auto &diagnostic : diagnostics)
+            mDiagnostics.insert(diagnostic);
+        forEachSources([&parsed](Sources &sources) -> VisitResult {
+                for (const auto &it : parsed) {
+                    if (sources.contains(it.first))
+                        sources[it.first].parsed = it.second;
+                }
+                return Continue;
+            });
+        for (const auto &it : durations) {
+            if (it.second) {
+                mIndexDurations[it.first] = it.second;
+            } else {
+                mIndexDurations.remove(it.first);
+            }
+        }
+        for (const auto &it : memory) {
+            if (it.second) {
+                mIndexMemory[it.first] = it.second;
+            } else {
+                mIndexMemory.remove(it.first);
+            }
+        }
+    }
+    if (records)
+        debug("Replayed %d journal records for %s", records, mPath.constData());
+    return pos == journal.size();
+}
+
+void Project::openJournal(bool truncate)
+{
+    closeJournal();
+    const Path path = mProjectFilePath + ".journal";
+    mJournal = fopen(path.constData(), truncate ? "w" : "a");
+    if (!mJournal) {
+        error("Can't open journal %s: %s", path.constData(), Rct::strerror().constData());
+        return;
+    }
+    if (!truncate) {
+        mJournalSize = path.fileSize();
+        return;
+    }
+    const int version = RTags::DatabaseVersion;
+    if (!fwrite(&version, sizeof(version), 1, mJournal)
+        || !fwrite(&mJournalGeneration, sizeof(mJournalGeneration), 1, mJournal)
+        || fflush(mJournal)) {
+        closeJournal();
+        Path::rm(path);
+        return;
+    }
+    mJournalSize = sizeof(version) + sizeof(mJournalGeneration);
+}
+
+void Project::closeJournal()
+{
+    if (mJournal) {
+        fclose(mJournal);
+        mJournal = 0;
+    }
+    mJournalSize = 0;
+}
+
+void Project::clearJournal()
+{
+    mJournalDependencies.clear();
+    mJournalDiagnostics.clear();
+    mJournalTimings.clear();
+    mJournalParsed.clear();
+    mJournalFileIdIndexDirty.clear();
+    mJournalCompact = false;
+}
+
+uint32_t Project::predictedIndexDuration(uint32_t fileId) const
+{
+    const uint32_t ms = mIndexDurations.value(fileId);
+    if (ms || mIndexDurations.isEmpty())
+        return ms;
+    return static_cast<uint32_t>(mIndexDurationTotal / mIndexDurations.size());
+}
+
+void Project::recordIndexDuration(uint32_t fileId, uint32_t ms)
+{
+    mJournalTimings.insert(fileId);
+    uint32_t &duration = mIndexDurations[fileId];
+    mIndexDurationTotal -= duration;
+    duration = duration ? (duration + ms) / 2 : std::max<uint32_t>(ms, 1);
+    mIndexDurationTotal += duration;
+}
+
+size_t Project::predictedIndexMemory(uint32_t fileId) const
+{
+    size_t kb = mIndexMemory.value(fileId);
+    if (!kb && !mIndexMemory.isEmpty())
+        kb = mIndexMemoryTotal / mIndexMemory.size();
+    return kb * 1024;
+}
+
+void Project::recordIndexMemory(uint32_t fileId, size_t bytes)
+{
+    const uint32_t kb = std::max<uint32_t>(bytes / 1024, 1);
+    mJournalTimings.insert(fileId);
+    uint32_t &peak = mIndexMemory[fileId];
+    mIndexMemoryTotal -= peak;
+    // a lower peak could just mean we sampled at the wrong time
+    peak = std::max(kb, (peak + kb) / 2);
+    mIndexMemoryTotal += peak;
+}
+
 void Project::index(const std::shared_ptr<IndexerJob> &job)
 {
     const Path sourceFile = job->sourceFile;
@@ -948,12 +1537,44 @@ void Project::onFileRemoved(const Path &file)
     }
 }
 
+// Touched files are hashed on the restore threads, like restore() does,
+// the main thread only gets the results.
 void Project::onDirtyTimeout(Timer *)
 {
-    Set<uint32_t> dirtyFiles = std::move(mPendingDirtyFiles);
+    const Set<uint32_t> dirtyFiles = std::move(mPendingDirtyFiles);
+    mPendingDirtyFiles.clear();
+    List<RestoreFile> files;
+    files.reserve(dirtyFiles.size());
+    for (uint32_t fileId : dirtyFiles) {
+        const DependencyNode *node = mDependencies.value(fileId);
+        files.append(RestoreFile { fileId, Location::path(fileId), Path(),
+                                   node ? node->contentHash : 0, node ? node->contentModified : 0, node ? node->contentVerified : 0,
+                                   0, 0, true, String(), false, std::shared_ptr<const FileIdIndexKeys>() });
+    }
+    Server::instance()->restoreThreadPool()->start(std::make_shared<RestoreJob>(shared_from_this(), std::move(files), StatOnly,
+                                                                                &Project::onDirtyChecked));
+}
+
+void Project::onDirtyChecked(List<RestoreFile> &&files)
+{
+    Set<uint32_t> dirtyFiles;
+    for (const RestoreFile &file : files)
+        dirtyFiles.insert(file.fileId);
     WatcherDirty dirty(shared_from_this(), dirtyFiles);
+    for (const RestoreFile &file : files)
+        dirty.prime(file.fileId, file.lastModified, file.hash);
     const int dirtied = startDirtyJobs(&dirty, IndexerJob::Dirty);
-    debug() << "onDirtyTimeout" << dirtyFiles << dirtied;
+    debug() << "onDirtyChecked" << dirtyFiles << dirtied;
+}
+
+void Project::setContentVerified(uint32_t fileId, uint64_t lastModified)
+{
+    DependencyNode *node = mDependencies.value(fileId);
+    if (!node || node->contentVerified == lastModified)
+        return;
+    node->contentVerified = lastModified;
+    mJournalDependencies.insert(fileId);
+    mSaveDirty = true;
 }
 
 SourceList Project::sources(uint32_t fileId) const
@@ -984,114 +1605,334 @@ bool Project::hasSource(uint32_t fileId) const
 Set<uint32_t> Project::dependencies(uint32_t fileId, DependencyMode mode) const
 {
     Set<uint32_t> ret;
+    const std::shared_ptr<const DependencyGraph> graph = dependencyGraph();
     if (mode == All) {
-        for (const auto &node : mDependencies) {
-            ret.insert(node.first);
-        }
+        for (uint32_t file : graph->fileIds())
+            ret.insert(file);
         return ret;
     }
-    ret.insert(fileId);
-    std::function<void(uint32_t)> fill = [&](uint32_t file) {
-        if (DependencyNode *node = mDependencies.value(file)) {
-            const auto &nodes = (mode == ArgDependsOn ? node->includes : node->dependents);
-            for (const auto &it : nodes) {
-                if (ret.insert(it.first))
-                    fill(it.first);
-            }
-        }
-    };
-    fill(fileId);
+    const auto files = graph->closure(fileId, mode == ArgDependsOn ? DependencyGraph::Includes : DependencyGraph::Dependents);
+    for (uint32_t file : *files)
+        ret.insert(file);
     return ret;
 }
 
 bool Project::dependsOn(uint32_t source, uint32_t header) const
 {
-    Set<uint32_t> seen;
-    std::function<bool(DependencyNode *node)> dep = [&](DependencyNode *node) {
-        assert(node);
-        if (!seen.insert(node->fileId))
-            return false;
-        if (node->dependents.contains(source))
-            return true;
-        for (const std::pair<uint32_t, DependencyNode*> &n : node->dependents) {
-            if (dep(n.second))
-                return true;
-        }
-        return false;
-    };
-    DependencyNode *node = mDependencies.value(header);
-    return node && dep(node);
+    return source != header && dependencyGraph()->reaches(source, header, DependencyGraph::Includes);
+}
+
+std::shared_ptr<const DependencyGraph> Project::dependencyGraph() const
+{
+    std::lock_guard<std::mutex> lock(mDependencyGraphMutex);
+    if (!mDependencyGraph) {
+        mDependencyGraph = std::make_shared<DependencyGraph>();
+    }
+    if (!mDependencyGraphIncludes.isEmpty() || !mDependencyGraphRemoved.isEmpty()) {
+        mDependencyGraph = std::make_shared<DependencyGraph>(*mDependencyGraph, mDependencyGraphIncludes, mDependencyGraphRemoved);
+        mDependencyGraphIncludes.clear();
+        mDependencyGraphRemoved.clear();
+    }
+    return mDependencyGraph;
+}
+
+void Project::setIncludes(uint32_t fileId, List<uint32_t> &&includes)
+{
+    // removals are applied last, one that's queued could otherwise take out
+    // the file or edges that are being added back
+    if (!mDependencyGraphRemoved.isEmpty())
+        dependencyGraph();
+    std::lock_guard<std::mutex> lock(mDependencyGraphMutex);
+    mDependencyGraphIncludes[fileId] = std::move(includes);
+}
+
+void Project::removeFromDependencyGraph(uint32_t fileId)
+{
+    std::lock_guard<std::mutex> lock(mDependencyGraphMutex);
+    mDependencyGraphIncludes.remove(fileId);
+    mDependencyGraphRemoved.insert(fileId);
 }
 
 void Project::removeDependencies(uint32_t fileId)
 {
+    invalidateSnapshot();
     // error() << "removeDependencies" << Location::path(fileId);
+    if (mFileMapCache)
+        mFileMapCache->forget(fileId);
+    mBloomFilterCache->forget(fileId);
     if (DependencyNode *node = mDependencies.take(fileId)) {
-        for (auto it : node->includes)
-            it.second->dependents.remove(fileId);
-        for (auto it : node->dependents)
-            it.second->includes.remove(fileId);
+        mFileIdIndexDirty.insert(fileId);
+        mJournalFileIdIndexDirty.insert(fileId);
+        // replaying the removal takes fileId out of its dependents' includes too
+        mJournalDependencies.insert(fileId);
+        removeFromDependencyGraph(fileId);
+        setFileIdIndexKeys(fileId, std::shared_ptr<const FileIdIndexKeys>());
         delete node;
     }
 }
 
+static const FileMapType fileIdIndexTypes[] = {
+    SymbolNames, Targets, Usrs, Subclasses, Callees, Callers
+};
+
+std::shared_ptr<FileMap<String, Set<uint32_t> > > &Project::fileIdIndex(FileMapType type)
+{
+    switch (type) {
+    case Targets: return mTargetIndex;
+    case Usrs: return mUsrIndex;
+    case Subclasses: return mSubclassIndex;
+    case Callees: return mCalleeIndex;
+    case Callers: return mCallerIndex;
+    default: break;
+    }
+    assert(type == SymbolNames);
+    return mSymbolNameIndex;
+}
+
+bool Project::loadFileIdIndexes()
+{
+    bool ret = true;
+    for (FileMapType type : fileIdIndexTypes) {
+        auto index = std::make_shared<FileMap<String, Set<uint32_t> > >();
+        if (index->load(fileIdIndexPath(type), fileMapOptions())) {
+            fileIdIndex(type) = index;
+        } else {
+            fileIdIndex(type).reset();
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+template <typename Value>
+static void addFileIdIndexKeys(const std::shared_ptr<FileMap<String, Value> > &fileMap, List<String> &keys)
+{
+    if (!fileMap)
+        return;
+    const uint32_t count = fileMap->count();
+    keys.reserve(count);
+    for (uint32_t i=0; i<count; ++i)
+        keys.append(fileMap->keyAt(i));
+}
+
+std::shared_ptr<const Project::FileIdIndexKeys> Project::readFileIdIndexKeys(const Path &path)
+{
+    auto container = std::make_shared<FileMapContainer>();
+    if (!container->load(path))
+        return std::shared_ptr<const FileIdIndexKeys>();
+    auto ret = std::make_shared<FileIdIndexKeys>();
+    for (FileMapType type : fileIdIndexTypes) {
+        if (type == Callees || type == Callers) {
+            addFileIdIndexKeys(container->fileMap<String, Set<String> >(type), ret->keys[type]);
+        } else {
+            addFileIdIndexKeys(container->fileMap<String, Set<Location> >(type), ret->keys[type]);
+        }
+    }
+    return ret;
+}
+
+size_t Project::FileIdIndexKeys::size() const
+{
+    size_t ret = sizeof(FileIdIndexKeys);
+    for (FileMapType type : fileIdIndexTypes) {
+        for (const String &key : keys[type])
+            ret += sizeof(String) + key.size();
+    }
+    return ret;
+}
+
+void Project::setFileIdIndexKeys(uint32_t fileId, const std::shared_ptr<const FileIdIndexKeys> &keys)
+{
+    std::shared_ptr<const FileIdIndexKeys> &entry = mFileIdIndexKeys[fileId];
+    if (entry)
+        mFileIdIndexKeysSize -= entry->size();
+    if (keys) {
+        entry = keys;
+        mFileIdIndexKeysSize += keys->size();
+    } else {
+        mFileIdIndexKeys.remove(fileId);
+    }
+}
+
+bool Project::saveFileIdIndexes()
+{
+    invalidateSnapshot();
+    StopWatch sw;
+    const uint32_t opts = fileMapOptions();
+    Map<String, Set<uint32_t> > indexes[Callers + 1];
+    for (FileMapType type : fileIdIndexTypes) {
+        const std::shared_ptr<FileMap<String, Set<uint32_t> > > &old = fileIdIndex(type);
+        if (!old)
+            continue;
+        Map<String, Set<uint32_t> > &index = indexes[type];
+        const uint32_t count = old->count();
+        for (uint32_t i=0; i<count; ++i) {
+            Set<uint32_t> files = old->valueAt(i);
+            if (!mFileIdIndexDirty.isEmpty()) {
+                auto it = files.begin();
+                while (it != files.end()) {
+                    if (mFileIdIndexDirty.contains(*it)) {
+                        files.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            if (!files.isEmpty())
+                index[old->keyAt(i)] = std::move(files);
+        }
+    }
+    // Most dirty files had their keys read when they were written, the rest
+    // are loaded once for all the indexes
+    for (uint32_t fileId : mFileIdIndexDirty) {
+        if (!mDependencies.contains(fileId))
+            continue;
+        std::shared_ptr<const FileIdIndexKeys> keys = mFileIdIndexKeys.value(fileId);
+        if (!keys && !(keys = readFileIdIndexKeys(sourceFilePath(fileId, FileMapContainer::fileName()))))
+            continue;
+        for (FileMapType type : fileIdIndexTypes) {
+            Map<String, Set<uint32_t> > &index = indexes[type];
+            for (const String &key : keys->keys[type])
+                index[key].insert(fileId);
+        }
+    }
+
+    bool ok = true;
+    for (FileMapType type : fileIdIndexTypes) {
+        // snapshots may still have the old index mapped so write a new file
+        // and rename it over the old one
+        fileIdIndex(type).reset();
+        const Path path = fileIdIndexPath(type);
+        const Path tmp = path + ".tmp";
+        if (!FileMap<String, Set<uint32_t> >::write(tmp, indexes[type], opts|FileMap<String, Set<uint32_t> >::PrefixIndex)
+            || ::rename(tmp.constData(), path.constData())) {
+            Path::rm(tmp);
+            ok = false;
+        }
+        warning() << "Wrote" << fileMapName(type) << "index for" << mPath << indexes[type].size() << "keys";
+        indexes[type].clear();
+    }
+    if (ok)
+        ok = loadFileIdIndexes();
+    if (!ok) {
+        // every file is dirty now
+        for (const auto &dep : mDependencies)
+            mFileIdIndexDirty.insert(dep.first);
+        return false;
+    }
+    mFileIdIndexDirty.clear();
+    mFileIdIndexKeys.clear();
+    mFileIdIndexKeysSize = 0;
+    warning() << "Wrote file id indexes for" << mPath << "in" << sw.elapsed() << "ms";
+    return true;
+}
+
+bool Project::filesContaining(FileMapType type, const String &key, Set<uint32_t> &files)
+{
+    const std::shared_ptr<FileMap<String, Set<uint32_t> > > &index = fileIdIndex(type);
+    if (!index)
+        return false;
+    files = index->value(key);
+    // the index is stale for dirty files, their current keys decide. One
+    // whose keys couldn't be read has to be searched.
+    const std::shared_ptr<const DependencyGraph> graph = dependencyGraph();
+    for (uint32_t fileId : mFileIdIndexDirty) {
+        bool contains = graph->contains(fileId);
+        if (contains) {
+            if (const std::shared_ptr<const FileIdIndexKeys> keys = mFileIdIndexKeys.value(fileId)) {
+                const List<String> &sorted = keys->keys[type];
+                const auto it = std::lower_bound(sorted.begin(), sorted.end(), key, [](const String &l, const String &r) {
+                        return l.compare(r) < 0;
+                    });
+                contains = it != sorted.end() && *it == key;
+            }
+        }
+        if (contains) {
+            files.insert(fileId);
+        } else {
+            files.remove(fileId);
+        }
+    }
+    return true;
+}
+
 void Project::updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDataMessage> &msg)
 {
+    invalidateSnapshot();
     static_cast<void>(fileId);
     const bool prune = !(msg->flags() & (IndexDataMessage::InclusionError|IndexDataMessage::ParseFailure));
     // error() << "updateDependencies" << Location::path(fileId) << prune;
-    Set<uint32_t> includeErrors, dirty;
+    Set<uint32_t> includeErrors, dirty, created;
+    DependencyGraph::Rows includes; // replaces the rows in the graph
     for (auto pair : msg->files()) {
         assert(pair.first);
         DependencyNode *&node = mDependencies[pair.first];
         // error() << "checking deps" << Location::path(pair.first) << node;
         if (!node) {
             node = new DependencyNode(pair.first);
+            created.insert(pair.first);
         }
+        mJournalDependencies.insert(pair.first);
 
         if (pair.second & IndexDataMessage::Visited) {
+            auto fileHash = msg->fileHashes().find(pair.first);
+            if (fileHash == msg->fileHashes().end()) {
+                node->contentHash = node->contentModified = node->contentVerified = 0;
+            } else {
+                if (fileHash->second.hash != node->contentHash || !node->contentModified) {
+                    node->contentHash = fileHash->second.hash;
+                    node->contentModified = fileHash->second.lastModified;
+                } // else only touched, the contents go further back than this mtime
+                node->contentVerified = fileHash->second.lastModified;
+            }
             if (pair.second & IndexDataMessage::IncludeError) {
                 node->flags |= DependencyNode::Flag_IncludeError;
                 includeErrors.insert(pair.first);
                 // error() << "got include error for" << Location::path(pair.first);
             } else if (node->flags & DependencyNode::Flag_IncludeError) {
-                // error() << "used to have include error for" << Location::path(pair.first) << node->includes.size();
+                // error() << "used to have include error for" << Location::path(pair.first);
                 node->flags &= ~DependencyNode::Flag_IncludeError;
                 dirty.insert(pair.first);
-                // for (auto dep : node->includes) {
-                //     dirty.insert(dep.first);
-                //     // error() << "dirty" << Location::path(dep.first);
-                // }
-                for (auto dep : node->dependents) {
-                    dirty.insert(dep.first);
-                    // error() << "dirty" << Location::path(dep.first);
+                for (uint32_t dep : dependencyGraph()->edges(pair.first, DependencyGraph::Dependents)) {
+                    dirty.insert(dep);
+                    // error() << "dirty" << Location::path(dep);
                 }
             }
             if (prune) {
-                for (auto it : node->includes) {
-                    it.second->dependents.remove(pair.first);
-                    // error() << "removing" << Location::path(pair.first) << "from" << Location::path(it.first);
-                }
-                // error() << "Removing all includes for" << Location::path(pair.first) << node->includes.size();
-                node->includes.clear();
+                // error() << "Removing all includes for" << Location::path(pair.first);
+                includes[pair.first];
             }
         }
         watchFile(pair.first);
     }
 
-    // // ### this probably deletes and recreates the same nodes very very often
     for (auto it : msg->includes()) {
         assert(it.first);
         assert(it.second);
         DependencyNode *&includer = mDependencies[it.first];
         DependencyNode *&inclusiary = mDependencies[it.second];
         // error() << "adding include for" << Location::path(it.first) << Location::path(it.second);
-        if (!includer)
+        if (!includer) {
             includer = new DependencyNode(it.first);
-        if (!inclusiary)
+            created.insert(it.first);
+        }
+        if (!inclusiary) {
             inclusiary = new DependencyNode(it.second);
-        includer->include(inclusiary);
+            created.insert(it.second);
+        }
+        auto row = includes.find(it.first);
+        if (row == includes.end()) // not pruned, the includes are added to what it had
+            row = includes.insert(std::make_pair(it.first, dependencyGraph()->edges(it.first, DependencyGraph::Includes))).first;
+        row->second.append(it.second);
+        mJournalDependencies.insert(it.first);
+        mJournalDependencies.insert(it.second);
+    }
+    for (uint32_t file : created) {
+        if (!includes.contains(file))
+            includes[file];
     }
+    for (auto &it : includes)
+        setIncludes(it.first, std::move(it.second));
 
     if (!includeErrors.isEmpty()) {
         // error() << "releasing files";
@@ -1109,18 +1950,6 @@ void Project::updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDat
         simple.init(shared_from_this(), dirty);
         startDirtyJobs(&simple, IndexerJob::Dirty);
     }
-    // for (auto node : mDependencies) {
-    //     for (auto inc : node.second->includes) {
-    //         if (!inc.second->dependents.contains(node.first)) {
-    //             error() << "SHIT SHIT SHIT" << Location::path(inc.first) << "doesn't have" << Location::path(node.first) << "in its dependents";
-    //         }
-    //     }
-    //     for (auto inc : node.second->dependents) {
-    //         if (!inc.second->includes.contains(node.first)) {
-    //             error() << "SHIT SHIT SHIT" << Location::path(inc.first) << "doesn't have" << Location::path(node.first) << "in its includes";
-    //         }
-    //     }
-    // }
 }
 
 int Project::reindex(const Match &match,
@@ -1150,6 +1979,7 @@ int Project::reindex(const Match &match,
 
 int Project::remove(const Match &match)
 {
+    invalidateSnapshot();
     int count = 0;
     forEachSourceList([&match, &count](SourceList &src) -> VisitResult {
             if (match.match(Location::path(src.fileId()))) {
@@ -1158,6 +1988,8 @@ int Project::remove(const Match &match)
             }
             return Continue;
         });
+    if (count)
+        mJournalCompact = true;
     return count;
 }
 
@@ -1178,6 +2010,7 @@ int Project::startDirtyJobs(Dirty *dirty, Flags<IndexerJob::Flag> flags,
         std::lock_guard<std::mutex> lock(mMutex);
         for (const auto &fileId : dirtyFiles) {
             mVisitedFiles.remove(fileId);
+            mJournalVisited.insert(fileId);
         }
     }
 
@@ -1185,6 +2018,14 @@ int Project::startDirtyJobs(Dirty *dirty, Flags<IndexerJob::Flag> flags,
     flags &= ~IndexerJob::NoAbort;
     assert(flags == IndexerJob::Dirty || flags == IndexerJob::Reindex);
 
+    Set<uint32_t> deferred;
+    const size_t representatives = Server::instance()->options().representativeSources;
+    if (representatives && flags == IndexerJob::Dirty && toIndex.size() > representatives) {
+        deferred = dirty->deferred(toIndex, representatives);
+        if (!deferred.isEmpty())
+            debug() << "Deferring" << deferred.size() << "of" << toIndex.size() << "dirty sources";
+    }
+
     std::weak_ptr<Connection> weakConn = wait;
     for (uint32_t fileId : toIndex) {
         if (noAbort) {
@@ -1198,7 +2039,10 @@ int Project::startDirtyJobs(Dirty *dirty, Flags<IndexerJob::Flag> flags,
             continue;
         }
 
-        auto job = std::make_shared<IndexerJob>(sources(fileId), flags, shared_from_this(), unsavedFiles);
+        Flags<IndexerJob::Flag> jobFlags = flags;
+        if (deferred.contains(fileId))
+            jobFlags |= IndexerJob::Deferred;
+        auto job = std::make_shared<IndexerJob>(sources(fileId), jobFlags, shared_from_this(), unsavedFiles);
         if (wait) {
             job->destroyed.connect([weakConn](IndexerJob *) {
                     // should arguably be refcounted but I don't know if anyone waits for multiple jobs
@@ -1215,6 +2059,8 @@ int Project::startDirtyJobs(Dirty *dirty, Flags<IndexerJob::Flag> flags,
 
 bool Project::isIndexed(uint32_t fileId) const
 {
+    if (mIsSnapshot)
+        return dependencyGraph()->contains(fileId);
     return mDependencies.contains(fileId);
 }
 
@@ -1225,11 +2071,13 @@ const Set<uint32_t> &Project::suspendedFiles() const
 
 void Project::clearSuspendedFiles()
 {
+    invalidateSnapshot();
     mSuspendedFiles.clear();
 }
 
 bool Project::toggleSuspendFile(uint32_t file)
 {
+    invalidateSnapshot();
     if (!mSuspendedFiles.insert(file)) {
         mSuspendedFiles.remove(file);
         return false;
@@ -1239,6 +2087,7 @@ bool Project::toggleSuspendFile(uint32_t file)
 
 void Project::setSuspended(uint32_t file, bool suspended)
 {
+    invalidateSnapshot();
     if (suspended) {
         mSuspendedFiles.insert(file);
     } else {
@@ -1277,6 +2126,7 @@ Diagnostics Project::updateDiagnostics(const Diagnostics &diagnostics)
                 mDiagnostics.erase(old++);
             }
             lastFile = f;
+            mJournalDiagnostics.insert(f);
 
             if (it.second.isNull() && !found) {
                 continue;
@@ -1337,7 +2187,31 @@ void Project::findSymbols(const String &unencoded,
         lowerBound = string;
     }
 
-    auto processFile = [this, &lowerBound, &string, wildcard, regex, &rx, cs, &inserter](uint32_t file) {
+    // returns 1 for a match, 0 for no match and -1 when no subsequent
+    // entries can match
+    auto match = [&string, wildcard, regex, &rx, cs](const StringView &entry, SymbolMatchType &type) -> int {
+        type = Exact;
+        if (!string.isEmpty()) {
+            if (wildcard) {
+                if (!entry.wildCmp(string.constData(), cs)) {
+                    return 0;
+                }
+                type = Wildcard;
+            } else if (regex) {
+                if (!std::regex_search(entry.begin(), entry.end(), rx)) {
+                    return 0;
+                }
+                type = Regexp;
+            } else if (!entry.startsWith(string, cs)) {
+                return cs == String::CaseInsensitive ? 0 : -1;
+            } else if (entry.size() != string.size()) {
+                type = StartsWith;
+            }
+        }
+        return 1;
+    };
+
+    auto processFile = [this, &lowerBound, &match, &inserter](uint32_t file) {
         auto symNames = openSymbolNames(file);
         if (!symNames)
             return;
@@ -1353,39 +2227,55 @@ void Project::findSymbols(const String &unencoded,
         }
 
         for (int i=idx; i<count; ++i) {
-            const String entry = symNames->keyAt(i);
-            // error() << i << count << entry;
-            SymbolMatchType type = Exact;
-            if (!string.isEmpty()) {
-                if (wildcard) {
-                    if (!Rct::wildCmp(string.constData(), entry.constData(), cs)) {
-                        continue;
-                    }
-                    type = Wildcard;
-                } else if (regex) {
-                    if (!std::regex_search(entry.ref(), rx)) {
-                        continue;
-                    }
-                    type = Regexp;
-                } else if (!entry.startsWith(string, cs)) {
-                    if (cs == String::CaseInsensitive) {
-                        continue;
-                    } else {
-                        break;
-                    }
-                } else if (entry.size() != string.size()) {
-                    type = StartsWith;
-                }
-            }
-            inserter(type, entry, symNames->valueAt(i));
+            // only materialize the entries that actually match
+            const StringView entry = symNames->keyView<StringView>(i);
+            // error() << i << count << entry.toString();
+            SymbolMatchType type;
+            const int matched = match(entry, type);
+            if (matched < 0)
+                break;
+            if (matched)
+                inserter(type, entry.toString(), symNames->valueAt(i));
         }
     };
 
     if (fileFilter) {
         processFile(fileFilter);
+    } else if (mSymbolNameIndex) {
+        // search the merged index and only open the files that have a match
+        const uint32_t count = mSymbolNameIndex->count();
+        uint32_t idx = 0;
+        if (!lowerBound.isEmpty())
+            idx = mSymbolNameIndex->lowerBound(lowerBound);
+        for (uint32_t i=idx; i<count; ++i) {
+            const StringView entry = mSymbolNameIndex->keyView<StringView>(i);
+            SymbolMatchType type;
+            const int matched = match(entry, type);
+            if (matched < 0)
+                break;
+            if (!matched)
+                continue;
+            const String name = entry.toString();
+            for (uint32_t file : mSymbolNameIndex->valueAt(i)) {
+                if (mFileIdIndexDirty.contains(file))
+                    continue;
+                auto symNames = openSymbolNames(file);
+                if (!symNames)
+                    continue;
+                bool found;
+                const Set<Location> locations = symNames->value(name, &found);
+                if (found)
+                    inserter(type, name, locations);
+            }
+        }
+        const std::shared_ptr<const DependencyGraph> graph = dependencyGraph();
+        for (uint32_t file : mFileIdIndexDirty) {
+            if (graph->contains(file))
+                processFile(file);
+        }
     } else {
-        for (const auto &dep : mDependencies) {
-            processFile(dep.first);
+        for (uint32_t file : dependencyGraph()->fileIds()) {
+            processFile(file);
         }
     }
 }
@@ -1593,27 +2483,86 @@ Set<Symbol> Project::findTargets(const Symbol &symbol)
     return ret;
 }
 
+// A file that is missing, short or has trailing data gives null filters,
+// they contain everything
+static std::shared_ptr<const BloomFilterCache::Filters> readBloomFilters(const Path &path)
+{
+    auto ret = std::make_shared<BloomFilterCache::Filters>();
+    const String data = path.readAll();
+    if (data.isEmpty())
+        return ret;
+    BloomFilterCache::Filters filters;
+    {
+        Deserializer deserializer(data);
+        deserializer >> filters.targets >> filters.usrs;
+    }
+    // a short read leaves the end of bits zeroed, writing the filters
+    // back is the only way to tell
+    String check;
+    {
+        Serializer serializer(check);
+        serializer << filters.targets << filters.usrs;
+    }
+    if (check != data || filters.targets.isNull() || filters.usrs.isNull()
+        || !filters.targets.hashCount || !filters.usrs.hashCount) {
+        error() << "Invalid bloom filters" << path;
+        return ret;
+    }
+    *ret = std::move(filters);
+    return ret;
+}
+
+bool Project::mayContain(FileMapType type, uint32_t fileId, const String &key)
+{
+    assert(type == Targets || type == Usrs);
+    std::shared_ptr<const BloomFilterCache::Filters> filters = mBloomFilterCache->find(fileId);
+    if (!filters) {
+        const uint32_t generation = mBloomFilterCache->generation(fileId);
+        filters = readBloomFilters(sourceFilePath(fileId, "bloom"));
+        mBloomFilterCache->insert(fileId, filters, generation);
+    }
+    const BloomFilter &filter = type == Targets ? filters->targets : filters->usrs;
+    const bool ret = filter.contains(key);
+    mBloomFilterCache->recordProbe(ret);
+    return ret;
+}
+
+static inline Set<uint32_t> intersection(const Set<uint32_t> &a, const Set<uint32_t> &b)
+{
+    const Set<uint32_t> &smaller = a.size() < b.size() ? a : b;
+    const Set<uint32_t> &larger = a.size() < b.size() ? b : a;
+    Set<uint32_t> ret;
+    for (uint32_t fileId : smaller) {
+        if (larger.contains(fileId))
+            ret.insert(ret.end(), fileId);
+    }
+    return ret;
+}
+
 Set<Symbol> Project::findByUsr(const String &usr, uint32_t fileId, DependencyMode mode)
 {
     assert(fileId);
     Set<Symbol> ret;
     String tusr = Sandbox::encoded(usr);
-    for (uint32_t file : dependencies(fileId, mode)) {
-        auto usrs = openUsrs(file);
-        // error() << usrs << Location::path(file) << usr;
-        if (usrs) {
-            // SBROOT
-            for (Location loc : usrs->value(tusr)) {
-                // error() << "got a loc" << loc;
-                const Symbol c = findSymbol(loc);
-                if (!c.isNull())
-                    ret.insert(c);
+    Set<uint32_t> files = dependencies(fileId, mode);
+    Set<uint32_t> indexed;
+    if (filesContaining(Usrs, tusr, indexed))
+        files = intersection(files, indexed);
+    ret = probeFiles(files, [this, &tusr](uint32_t file, Set<Symbol> &out) {
+            if (!mayContain(Usrs, file, tusr))
+                return;
+            auto usrs = openUsrs(file);
+            // error() << usrs << Location::path(file) << usr;
+            if (usrs) {
+                // SBROOT
+                for (Location loc : usrs->value(tusr)) {
+                    // error() << "got a loc" << loc;
+                    const Symbol c = findSymbol(loc);
+                    if (!c.isNull())
+                        out.insert(c);
+                }
             }
-            // for (int i=0; i<usrs->count(); ++i) {
-            //     error() << i << usrs->count() << usrs->keyAt(i) << usrs->valueAt(i);
-            // }
-        }
-    }
+        });
 
     if (ret.isEmpty() && usr.startsWith("/")) { // for break statements and includes
         Symbol sym;
@@ -1633,30 +2582,47 @@ static Set<Symbol> findReferences(const Set<Symbol> &inputs,
     // const bool isClazz = s.isClass();
     for (const Symbol &input : inputs) {
         //warning() << "Calling findReferences" << input.location;
-        auto process = [&](uint32_t dep) {
+        // SBROOT
+        const String tusr = Sandbox::encoded(input.usr);
+        auto process = [&](uint32_t dep, Set<Symbol> &out) {
             // error() << "Looking at file" << Location::path(dep) << "for input" << input.location;
+            if (!project->mayContain(Targets, dep, tusr))
+                return;
             auto targets = project->openTargets(dep);
             if (targets) {
-                // SBROOT
-                const String tusr = Sandbox::encoded(input.usr);
                 const Set<Location> locations = targets->value(tusr);
                 // error() << "Got locations for usr" << input.usr << locations;
                 for (const auto &loc : locations) {
                     auto sym = project->findSymbol(loc);
                     if (filter(input, sym))
-                        ret.insert(sym);
+                        out.insert(sym);
                 }
             }
         };
         const Set<uint32_t> deps = project->dependencies(input.location.fileId(), Project::DependsOnArg);
-        for (auto dep : deps)
-            process(dep);
+        Set<uint32_t> indexed, rest;
+        if (project->filesContaining(Targets, tusr, indexed)) {
+            // only the files that actually reference the usr
+            ret.unite(project->probeFiles(intersection(deps, indexed), process));
+
+            if (ret.isEmpty()) {
+                for (auto dep : indexed) {
+                    if (!deps.contains(dep))
+                        rest.insert(dep);
+                }
+                ret.unite(project->probeFiles(rest, process));
+            }
+            continue;
+        }
+
+        ret.unite(project->probeFiles(deps, process));
 
         if (ret.isEmpty()) {
-            for (auto dep : project->dependencies()) {
-                if (!deps.contains(dep.first))
-                    process(dep.first);
+            for (uint32_t dep : project->dependencyGraph()->fileIds()) {
+                if (!deps.contains(dep))
+                    rest.insert(dep);
             }
+            ret.unite(project->probeFiles(rest, process));
         }
     }
     return ret;
@@ -1842,41 +2808,174 @@ Set<String> Project::findTargetUsrs(const Symbol &symbol)
 Set<Symbol> Project::findSubclasses(const Symbol &symbol)
 {
     assert(symbol.isClass() && symbol.isDefinition());
-    Set<Symbol> ret;
-    for (uint32_t dep : dependencies(symbol.location.fileId(), DependsOnArg)) {
-        auto symbols = openSymbols(dep);
-        if (symbols) {
-            const int count = symbols->count();
-            for (int i=0; i<count; ++i) {
-                const Symbol s = symbols->valueAt(i);
-                if (s.baseClasses.contains(symbol.usr))
-                    ret.insert(s);
+    Set<uint32_t> files = dependencies(symbol.location.fileId(), DependsOnArg);
+    Set<uint32_t> indexed;
+    if (filesContaining(Subclasses, symbol.usr, indexed))
+        files = intersection(files, indexed);
+    return probeFiles(files, [this, &symbol](uint32_t dep, Set<Symbol> &out) {
+            auto subclasses = openSubclasses(dep);
+            if (subclasses) {
+                for (Location loc : subclasses->value(symbol.usr)) {
+                    const Symbol s = findSymbol(loc);
+                    if (!s.isNull())
+                        out.insert(s);
+                }
             }
+        });
+}
+
+Set<String> Project::findCallGraphEdges(FileMapType type, const String &usr)
+{
+    assert(type == Callees || type == Callers);
+    // SBROOT
+    const String tusr = Sandbox::encoded(usr);
+    Set<uint32_t> files;
+    if (!filesContaining(type, tusr, files))
+        files = dependencies(0, All);
+    Set<String> ret;
+    for (uint32_t file : files) {
+        auto edges = type == Callees ? openCallees(file) : openCallers(file);
+        if (edges) {
+            for (const String &edge : edges->value(tusr))
+                ret.insert(Sandbox::decoded(edge));
         }
     }
     return ret;
 }
 
+class ProbeJob : public ThreadPool::Job
+{
+public:
+    ProbeJob(std::function<void()> &&func)
+        : mFunc(std::move(func))
+    {}
+protected:
+    virtual void run() override { mFunc(); }
+private:
+    std::function<void()> mFunc;
+};
+
+Set<Symbol> Project::probeFiles(const Set<uint32_t> &files, const std::function<void(uint32_t, Set<Symbol> &)> &probe)
+{
+    Set<Symbol> ret;
+    FileMapScope *scope = fileMapScope();
+    const std::shared_ptr<ThreadPool> pool = Server::instance()->probeThreadPool();
+    if (!pool || scope->worker || files.size() < MinProbeFiles) {
+        for (uint32_t file : files)
+            probe(file, ret);
+        return ret;
+    }
+
+    // Files are claimed one at a time by the caller and the workers so a busy
+    // pool only slows us down. Workers that start after everything has been
+    // claimed do nothing, they never touch the caller's stack.
+    struct State {
+        List<uint32_t> files;
+        List<Set<Symbol> > results;
+        std::atomic<size_t> next;
+        size_t done;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->files.reserve(files.size());
+    for (uint32_t file : files)
+        state->files.append(file);
+    state->results.resize(files.size());
+    state->next = 0;
+    state->done = 0;
+
+    const std::shared_ptr<ContainerCache> cache = scope->cache;
+    const int max = scope->max;
+    const size_t jobs = std::min<size_t>(Server::instance()->options().probeThreads, files.size() / MinProbeFiles);
+    for (size_t i=0; i<jobs; ++i) {
+        pool->start(std::make_shared<ProbeJob>([this, state, cache, max, &probe]() {
+                    size_t idx = state->next++;
+                    if (idx >= state->files.size())
+                        return;
+                    assert(!sFileMapScope);
+                    sFileMapScope = new FileMapScope(shared_from_this(), max, cache);
+                    size_t count = 0;
+                    do {
+                        probe(state->files.at(idx), state->results[idx]);
+                        ++count;
+                    } while ((idx = state->next++) < state->files.size());
+                    delete sFileMapScope;
+                    sFileMapScope = 0;
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->done += count;
+                    state->condition.notify_one();
+                }));
+    }
+
+    size_t count = 0;
+    for (size_t idx; (idx = state->next++) < state->files.size(); ++count)
+        probe(state->files.at(idx), state->results[idx]);
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done += count;
+        while (state->done < state->files.size())
+            state->condition.wait(lock);
+    }
+
+    for (const Set<Symbol> &result : state->results)
+        ret.unite(result);
+    return ret;
+}
+
+thread_local Project::FileMapScope *Project::sFileMapScope = 0;
+
 void Project::beginScope()
 {
-    assert(!mFileMapScope);
-    mFileMapScope.reset(new FileMapScope(shared_from_this(), Server::instance()->options().maxFileMapScopeCacheSize));
+    assert(!sFileMapScope);
+    sFileMapScope = new FileMapScope(shared_from_this(), Server::instance()->options().maxFileMapScopeCacheSize);
 }
 
 void Project::endScope()
 {
-    assert(mFileMapScope);
-    mFileMapScope.reset();
+    assert(sFileMapScope);
+    assert(sFileMapScope->project.get() == this);
+    delete sFileMapScope;
+    sFileMapScope = 0;
+}
+
+std::shared_ptr<Project> Project::snapshot()
+{
+    assert(EventLoop::isMainThread());
+    assert(!mIsSnapshot);
+    if (mSnapshot)
+        return mSnapshot;
+
+    std::shared_ptr<Project> ret = std::make_shared<Project>(mPath);
+    ret->mIsSnapshot = true;
+    ret->mSnapshotOf = shared_from_this();
+    // Only what queries read is shared with the snapshot. The graph and the
+    // indexes are immutable, the dirty set is bounded by compaction.
+    // mDependencies, the sources and the visited files are left empty.
+    ret->mDependencyGraph = dependencyGraph();
+    ret->mSymbolNameIndex = mSymbolNameIndex;
+    ret->mTargetIndex = mTargetIndex;
+    ret->mUsrIndex = mUsrIndex;
+    ret->mSubclassIndex = mSubclassIndex;
+    ret->mCalleeIndex = mCalleeIndex;
+    ret->mCallerIndex = mCallerIndex;
+    ret->mFileIdIndexDirty = mFileIdIndexDirty;
+    ret->mFileIdIndexKeys = mFileIdIndexKeys;
+    ret->mBloomFilterCache = mBloomFilterCache;
+    ret->mFileMapCache = mFileMapCache;
+    mSnapshot = ret;
+    return ret;
 }
 
-static String addDeps(const Dependencies &deps)
+static String addDeps(const List<uint32_t> &deps)
 {
     if (deps.isEmpty())
         return "nil";
     String ret;
     ret << "(list";
-    for (const auto &dep : deps) {
-        ret << " \"" << Location::path(dep.first) << "\"";
+    for (uint32_t dep : deps) {
+        ret << " \"" << Location::path(dep) << "\"";
     }
     ret << ")";
     return ret;
@@ -1885,39 +2984,43 @@ static String addDeps(const Dependencies &deps)
 String Project::dumpDependencies(uint32_t fileId, const List<String> &args, Flags<QueryMessage::Flag> flags) const
 {
     String ret;
+    const std::shared_ptr<const DependencyGraph> graph = dependencyGraph();
 
-    auto dumpRaw = [&ret, flags](DependencyNode *n) {
+    auto dumpRaw = [&ret, &graph, flags](uint32_t file) {
+        const List<uint32_t> includes = graph->edges(file, DependencyGraph::Includes);
+        const List<uint32_t> dependents = graph->edges(file, DependencyGraph::Dependents);
         if (!(flags & QueryMessage::Elisp)) {
-            ret << Location::path(n->fileId) << "\n";
-            for (const auto &inc : n->includes) {
-                ret << "  " << Location::path(inc.second->fileId) << "\n";
+            ret << Location::path(file) << "\n";
+            for (uint32_t inc : includes) {
+                ret << "  " << Location::path(inc) << "\n";
             }
-            for (const auto &dep : n->dependents) {
-                ret << "    " << Location::path(dep.second->fileId) << "\n";
+            for (uint32_t dep : dependents) {
+                ret << "    " << Location::path(dep) << "\n";
             }
             return;
         }
 
-        ret << " (cons \"" << Location::path(n->fileId) << "\" (cons " << addDeps(n->includes) << ' ' << addDeps(n->dependents) << "))\n";
+        ret << " (cons \"" << Location::path(file) << "\" (cons " << addDeps(includes) << ' ' << addDeps(dependents) << "))\n";
     };
 
     if (fileId) {
-        DependencyNode *node = mDependencies.value(fileId);
-        if (!node)
+        if (!graph->contains(fileId))
             return String::format<128>("Can't find node for %s", Location::path(fileId).constData());
 
-        if (!node->includes.isEmpty() && (args.isEmpty() || args.contains("includes"))) {
+        const List<uint32_t> includes = graph->edges(fileId, DependencyGraph::Includes);
+        if (!includes.isEmpty() && (args.isEmpty() || args.contains("includes"))) {
             if (args.size() != 1)
                 ret += String::format<256>("  %s includes:\n", Location::path(fileId).constData());
-            for (const auto &include : node->includes) {
-                ret += String::format<256>("    %s\n", Location::path(include.first).constData());
+            for (uint32_t include : includes) {
+                ret += String::format<256>("    %s\n", Location::path(include).constData());
             }
         }
-        if (!node->dependents.isEmpty() && (args.isEmpty() || args.contains("included-by"))) {
+        const List<uint32_t> dependents = graph->edges(fileId, DependencyGraph::Dependents);
+        if (!dependents.isEmpty() && (args.isEmpty() || args.contains("included-by"))) {
             if (args.size() != 1)
                 ret += String::format<256>("  %s is included by:\n", Location::path(fileId).constData());
-            for (const auto &include : node->dependents) {
-                ret += String::format<256>("    %s\n", Location::path(include.first).constData());
+            for (uint32_t include : dependents) {
+                ret += String::format<256>("    %s\n", Location::path(include).constData());
             }
         }
 
@@ -1948,53 +3051,40 @@ String Project::dumpDependencies(uint32_t fileId, const List<String> &args, Flag
         }
 
         if (args.isEmpty() || args.contains("tree-depends-on")) {
-            Set<DependencyNode*> seen;
-
-            DependencyNode *depNode = mDependencies.value(fileId);
-            if (depNode) {
-                int startDepth = 1;
-                if (args.size() != 1) {
-                    ++startDepth;
-                    ret += String::format<256>("  %s include tree:\n", Location::path(fileId).constData());
-                }
+            Set<uint32_t> seen;
+            int startDepth = 1;
+            if (args.size() != 1) {
+                ++startDepth;
+                ret += String::format<256>("  %s include tree:\n", Location::path(fileId).constData());
+            }
 
-                std::function<void(DependencyNode *, int)> process = [&](DependencyNode *n, int depth) {
-                    ret += String::format<256>("%s%s", String(depth * 2, ' ').constData(), Location::path(n->fileId).constData());
+            std::function<void(uint32_t, int)> process = [&](uint32_t file, int depth) {
+                ret += String::format<256>("%s%s", String(depth * 2, ' ').constData(), Location::path(file).constData());
 
-                    if (seen.insert(n) && !n->includes.isEmpty()) {
-                        ret += " includes:\n";
-                        for (const auto &includeNode : n->includes) {
-                            process(includeNode.second, depth + 1);
-                        }
-                    } else {
-                        ret += '\n';
+                const List<uint32_t> fileIncludes = graph->edges(file, DependencyGraph::Includes);
+                if (seen.insert(file) && !fileIncludes.isEmpty()) {
+                    ret += " includes:\n";
+                    for (uint32_t include : fileIncludes) {
+                        process(include, depth + 1);
                     }
-                };
-                process(depNode, startDepth);
-            }
-        }
-        if (args.size() == 1 && args.contains("raw")) {
-            Set<DependencyNode*> all;
-            std::function<void(DependencyNode *node)> add = [&](DependencyNode *depNode) {
-                assert(depNode);
-                if (!all.insert(depNode))
-                    return;
-                for (const std::pair<uint32_t, DependencyNode*> &n : depNode->includes) {
-                    add(n.second);
+                } else {
+                    ret += '\n';
                 }
             };
-            add(node);
+            process(fileId, startDepth);
+        }
+        if (args.size() == 1 && args.contains("raw")) {
             ret << "(list\n";
-            for (DependencyNode *n : all) {
-                dumpRaw(n);
+            for (uint32_t file : *graph->closure(fileId, DependencyGraph::Includes)) {
+                dumpRaw(file);
             }
             ret.chop(1);
             ret << ")\n";
         }
     } else {
         ret << "(list\n";
-        for (const auto &node : mDependencies) {
-            dumpRaw(node.second);
+        for (uint32_t file : graph->fileIds()) {
+            dumpRaw(file);
         }
         ret.chop(1);
         ret << ")\n";
@@ -2012,54 +3102,98 @@ void Project::dirty(uint32_t fileId)
     startDirtyJobs(&dirty, IndexerJob::Dirty);
 }
 
-bool Project::validate(uint32_t fileId, ValidateMode mode, String *err) const
+bool Project::validateFileMaps(const Path &path, String *error)
+{
+    auto container = std::make_shared<FileMapContainer>();
+    if (!container->load(path, error))
+        return false;
+    for (auto type : { Symbols, SymbolNames, Targets, Usrs, Tokens, Subclasses, Callees, Callers }) {
+        if (!container->contains(type)) {
+            if (error)
+                *error = String::format<32>("Missing section %s", fileMapName(type));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Project::validate(uint32_t fileId, ValidateMode mode, String *err, uint32_t expectedSize) const
+{
+    return validate(sourceFilePath(fileId, FileMapContainer::fileName()), fileId, mode, err, expectedSize);
+}
+
+bool Project::validate(const Path &path, uint32_t fileId, ValidateMode mode, String *err, uint32_t expectedSize)
 {
     if (mode == Validate) {
-        Path path;
         String error;
-        const uint32_t opts = fileMapOptions();
-        {
-            path = sourceFilePath(fileId, fileMapName(SymbolNames));
-            FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
-                goto error;
-        }
-        {
-            path = sourceFilePath(fileId, fileMapName(Symbols));
-            FileMap<Location, Symbol> fileMap;
-            if (!fileMap.load(path, opts, &error))
-                goto error;
-        }
-        {
-            path = sourceFilePath(fileId, fileMapName(Targets));
-            FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
-                goto error;
-        }
-        {
-            path = sourceFilePath(fileId, fileMapName(Usrs));
-            FileMap<String, Set<Location> > fileMap;
-            if (!fileMap.load(path, opts, &error))
-                goto error;
-        }
-        return true;
-  error:
+        if (validateFileMaps(path, &error))
+            return true;
         if (err)
             Log(err) << "Error during validation:" << Location::path(fileId) << error << path;
         return false;
     } else {
         assert(mode == StatOnly);
-        for (auto type : { Symbols, SymbolNames, Targets, Usrs }) {
-            const Path p = sourceFilePath(fileId, fileMapName(type));
-            if (!p.isFile()) {
-                Log(err) << "Error during validation:" << Location::path(fileId) << p << "doesn't exist";
-                return false;
-            }
+        struct stat st;
+        if (stat(path.constData(), &st) || !S_ISREG(st.st_mode)) {
+            Log(err) << "Error during validation:" << Location::path(fileId) << path << "doesn't exist";
+            return false;
+        }
+        if (expectedSize && static_cast<uint64_t>(st.st_size) != expectedSize) {
+            Log(err) << "Error during validation:" << Location::path(fileId) << path
+                     << "has size" << static_cast<uint64_t>(st.st_size) << "expected" << expectedSize;
+            return false;
         }
     }
     return true;
 }
 
+class VerifyJob : public ThreadPool::Job
+{
+public:
+    VerifyJob(const std::shared_ptr<Project> &project, uint32_t fileId, const Set<uint32_t> &files)
+        : mProject(project), mFileId(fileId)
+    {
+        for (uint32_t file : files)
+            mPaths.append(project->sourceFilePath(file, FileMapContainer::fileName()));
+    }
+protected:
+    virtual void run() override
+    {
+        for (const Path &path : mPaths) {
+            String err;
+            if (!Project::validateFileMaps(path, &err)) {
+                error() << "Error during verification:" << path << err;
+                // the project can only be touched, and destroyed, on the main thread
+                std::weak_ptr<Project> weak = mProject;
+                const uint32_t fileId = mFileId;
+                EventLoop::mainEventLoop()->callLater([weak, fileId]() {
+                        if (std::shared_ptr<Project> project = weak.lock())
+                            project->dirty(fileId);
+                    });
+                return;
+            }
+        }
+    }
+private:
+    const std::weak_ptr<Project> mProject;
+    const uint32_t mFileId;
+    List<Path> mPaths;
+};
+
+void Project::verifyFileMaps(uint32_t fileId, const Set<uint32_t> &files)
+{
+    if (std::shared_ptr<ThreadPool> pool = Server::instance()->verifyThreadPool()) {
+        pool->start(std::make_shared<VerifyJob>(shared_from_this(), fileId, files));
+    } else {
+        for (uint32_t file : files) {
+            if (!validate(file, Validate)) {
+                dirty(fileId);
+                return;
+            }
+        }
+    }
+}
+
 template <typename T>
 static inline String toString(const T &t, size_t &max)
 {
@@ -2267,6 +3401,8 @@ size_t estimateMemory(const Source &source);
 template <typename T>
 size_t estimateMemory(const std::shared_ptr<T> &ptr);
 template <typename T>
+size_t estimateMemory(const Interned<T> &interned);
+template <typename T>
 size_t estimateMemory(const T *t);
 template <typename T>
 size_t estimateMemory(const Set<T> &container);
@@ -2305,6 +3441,7 @@ size_t estimateMemory(const Source &source)
     ret += estimateMemory(source.extraCompiler);
     ret += estimateMemory(source.defines);
     ret += estimateMemory(source.includePaths);
+    ret += estimateMemory(source.arguments);
     ret += estimateMemory(source.directory);
     return ret;
 }
@@ -2321,6 +3458,16 @@ size_t estimateMemory(const std::shared_ptr<T> &ptr)
     return ret;
 }
 
+// shared blocks are split between the values sharing them
+template <typename T>
+size_t estimateMemory(const Interned<T> &interned)
+{
+    size_t ret = sizeof(interned);
+    if (const long count = interned.useCount())
+        ret += estimateMemory(interned.get()) / count;
+    return ret;
+}
+
 template <typename T>
 size_t estimateMemory(const T *t)
 {
@@ -2392,12 +3539,18 @@ String Project::estimateMemory() const
         deps += ::estimateMemory(*dep.second);
     }
     add("Dependencies", deps);
+    {
+        std::lock_guard<std::mutex> lock(mDependencyGraphMutex);
+        if (mDependencyGraph)
+            add("Dependency graph", mDependencyGraph->memoryUsage());
+    }
     add("Total", total);
     return String::join(ret, "\n");
 }
 
 void Project::reloadCompileCommands()
 {
+    invalidateSnapshot();
     mReloadCompileCommandsTimer.stop();
     if (!Server::instance()->suspended()) {
         SourceCache cache;
@@ -2415,6 +3568,7 @@ void Project::reloadCompileCommands()
                     removed[src.first] = it->first;
                 }
                 mIndexParseData.compileCommands.erase(it++);
+                mJournalCompact = true;
                 continue;
             }
 
@@ -2440,7 +3594,7 @@ uint32_t Project::fileMapOptions() const
 
 void Project::fixPCH(Source &source)
 {
-    for (Source::Include &inc : source.includePaths) {
+    for (Source::Include &inc : source.includePaths.mutate()) {
         if (inc.type == Source::Include::Type_PCH) {
             const uint32_t fileId = Location::insertFile(inc.path);
             inc.path = RTags::encodeSourceFilePath(Server::instance()->options().dataDir, mPath, fileId) + "pch.h";
@@ -2452,8 +3606,9 @@ void Project::fixPCH(Source &source)
 void Project::includeCompletions(Flags<QueryMessage::Flag> flags, const std::shared_ptr<Connection> &conn, Source &&source) const
 {
     CompilerManager::applyToSource(source, CompilerManager::IncludeIncludePaths);
-    source.includePaths.append(Server::instance()->options().includePaths);
-    source.includePaths.sort();
+    List<Source::Include> &includePaths = source.includePaths.mutate();
+    includePaths.append(Server::instance()->options().includePaths);
+    includePaths.sort();
     Set<Path> seen;
     if (flags & QueryMessage::Elisp) {
         conn->write("(list");
@@ -2522,6 +3677,8 @@ void Project::reindex(uint32_t fileId, Flags<IndexerJob::Flag> flags)
 
 void Project::processParseData(IndexParseData &&data)
 {
+    invalidateSnapshot();
+    mJournalCompact = true;
     Set<uint32_t> index;
     Hash<uint32_t, uint32_t> removed;
     if (mIndexParseData.isEmpty()) {
@@ -2778,6 +3935,10 @@ void Project::removeSources(const Hash<uint32_t, uint32_t> &removed)
 
 void Project::removeSource(uint32_t fileId)
 {
+    invalidateSnapshot();
+    mIndexDurationTotal -= mIndexDurations.take(fileId);
+    mIndexMemoryTotal -= mIndexMemory.take(fileId);
+    mJournalTimings.insert(fileId);
     std::shared_ptr<IndexerJob> job = mActiveJobs.take(fileId);
     if (job) {
         releaseFileIds(job->visited);
@@ -2793,6 +3954,14 @@ void Project::removeSource(uint32_t fileId)
 
 void Project::validateAll()
 {
+    if (mIsSnapshot) {
+        std::weak_ptr<Project> weak = mSnapshotOf;
+        EventLoop::mainEventLoop()->callLater([weak]() {
+                if (std::shared_ptr<Project> project = weak.lock())
+                    project->validateAll();
+            });
+        return;
+    }
     SimpleDirty dirty;
     dirty.init(shared_from_this());
     bool clean = true;
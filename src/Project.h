@@ -16,9 +16,11 @@
 #ifndef Project_h
 #define Project_h
 
+#include <stdio.h>
 #include <cstdint>
 #include <mutex>
 
+#include "BloomFilter.h"
 #include "Diagnostic.h"
 #include "FileMap.h"
 #include "IndexerJob.h"
@@ -36,6 +38,7 @@
 #include "Token.h"
 
 class Connection;
+class DependencyGraph;
 class Dirty;
 class FileManager;
 class IndexDataMessage;
@@ -48,20 +51,19 @@ struct DependencyNode
         Flag_IncludeError = 0x1
     };
     DependencyNode(uint32_t f, Flags<Flag> l = NullFlags)
-        : fileId(f), flags(l)
+        : fileId(f), flags(l), contentHash(0), contentModified(0), contentVerified(0)
     {}
-    void include(DependencyNode *dependee)
-    {
-        assert(!includes.contains(dependee->fileId) || includes.value(dependee->fileId) == dependee);
-        includes[dependee->fileId] = dependee;
-        assert(!dependee->dependents.contains(fileId) || dependee->dependents.value(fileId) == this);
-        dependee->dependents[fileId] = this;
-    }
 
-    Dependencies dependents, includes;
+    // the includes and dependents are only in Project::dependencyGraph()
     uint32_t fileId;
 
     Flags<Flag> flags;
+    // Hash of the contents when last indexed, unchanged since
+    // contentModified. 0 if unknown.
+    uint64_t contentHash, contentModified;
+    // The last mtime the file was seen with that still hashed to
+    // contentHash, a touched file isn't read again until its mtime changes.
+    uint64_t contentVerified;
 };
 
 RCT_FLAGS(DependencyNode::Flag);
@@ -72,55 +74,58 @@ public:
     Project(const Path &path);
     ~Project();
     bool init();
+    // Checks every dependency and its FileMaps on Server's restore threads
+    // and reindexes whatever changed while rdm wasn't running. Projects are
+    // restored when they're first used, queries are answered from what init()
+    // loaded in the meantime.
+    void restore();
+    bool isRestored() const { return !mRestore; }
 
     std::shared_ptr<FileManager> fileManager() const { return mFileManager; }
 
     Path path() const { return mPath; }
     bool match(const Match &match, bool *indexed = 0) const;
 
-    enum FileMapType {
-        Symbols,
-        SymbolNames,
-        Targets,
-        Usrs,
-        Tokens
-    };
-    static const char *fileMapName(FileMapType type)
-    {
-        switch (type) {
-        case Symbols: return "symbols";
-        case SymbolNames: return "symnames";
-        case Targets: return "targets";
-        case Usrs: return "usrs";
-        case Tokens: return "tokens";
-        }
-        return 0;
-    }
     std::shared_ptr<FileMap<String, Set<Location> > > openSymbolNames(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(SymbolNames, fileId, mFileMapScope->symbolNames, err);
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<Location> >(SymbolNames, fileId, scope->symbolNames, err);
     }
     std::shared_ptr<FileMap<Location, Symbol> > openSymbols(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<Location, Symbol>(Symbols, fileId, mFileMapScope->symbols, err);
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<Location, Symbol>(Symbols, fileId, scope->symbols, err);
     }
     std::shared_ptr<FileMap<String, Set<Location> > > openTargets(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Targets, fileId, mFileMapScope->targets, err);
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<Location> >(Targets, fileId, scope->targets, err);
     }
     std::shared_ptr<FileMap<String, Set<Location> > > openUsrs(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<String, Set<Location> >(Usrs, fileId, mFileMapScope->usrs, err);
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<Location> >(Usrs, fileId, scope->usrs, err);
     }
 
     std::shared_ptr<FileMap<uint32_t, Token> > openTokens(uint32_t fileId, String *err = 0)
     {
-        assert(mFileMapScope);
-        return mFileMapScope->openFileMap<uint32_t, Token>(Tokens, fileId, mFileMapScope->tokens, err);
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<uint32_t, Token>(Tokens, fileId, scope->tokens, err);
+    }
+    std::shared_ptr<FileMap<String, Set<Location> > > openSubclasses(uint32_t fileId, String *err = 0)
+    {
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<Location> >(Subclasses, fileId, scope->subclasses, err);
+    }
+    std::shared_ptr<FileMap<String, Set<String> > > openCallees(uint32_t fileId, String *err = 0)
+    {
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<String> >(Callees, fileId, scope->callees, err);
+    }
+    std::shared_ptr<FileMap<String, Set<String> > > openCallers(uint32_t fileId, String *err = 0)
+    {
+        FileMapScope *scope = fileMapScope();
+        return scope->openFileMap<String, Set<String> >(Callers, fileId, scope->callers, err);
     }
 
 
@@ -132,11 +137,17 @@ public:
 
     Set<uint32_t> dependencies(uint32_t fileId, DependencyMode mode) const;
     bool dependsOn(uint32_t source, uint32_t header) const;
+    // The includes of every file in mDependencies. Changes are applied to a
+    // copy the next time it's asked for, snapshots share it.
+    std::shared_ptr<const DependencyGraph> dependencyGraph() const;
     String dumpDependencies(uint32_t fileId,
                             const List<String> &args = List<String>(),
                             Flags<QueryMessage::Flag> flags = Flags<QueryMessage::Flag>()) const;
+    // empty for snapshots
     const Hash<uint32_t, DependencyNode*> &dependencies() const { return mDependencies; }
     DependencyNode *dependencyNode(uint32_t fileId) const { return mDependencies.value(fileId); }
+    // fileId still hashes to its contentHash at lastModified
+    void setContentVerified(uint32_t fileId, uint64_t lastModified);
 
     static bool readSources(const Path &path, IndexParseData &data, String *error);
     enum SymbolMatchType {
@@ -169,8 +180,27 @@ public:
     Set<String> findTargetUsrs(const Symbol &symbol);
     Set<String> findTargetUsrs(Location loc);
     Set<Symbol> findSubclasses(const Symbol &symbol);
+    // Usrs of the functions that call (type == Callers) or are called by
+    // (type == Callees) the function with this usr
+    Set<String> findCallGraphEdges(FileMapType type, const String &usr);
 
     Set<Symbol> findByUsr(const String &usr, uint32_t fileId, DependencyMode mode);
+    // Calls probe for each file and unites the results in file order. Large
+    // sets are spread over Server's probe thread pool, each worker gets a
+    // FileMap scope sharing the caller's containers.
+    Set<Symbol> probeFiles(const Set<uint32_t> &files, const std::function<void(uint32_t, Set<Symbol> &)> &probe);
+    enum { MinProbeFiles = 8 };
+    // Files whose fileIdIndexTypes FileMap contains the (encoded) key, dirty
+    // files are checked against mFileIdIndexKeys. Returns false if there is
+    // no index to answer this.
+    bool filesContaining(FileMapType type, const String &key, Set<uint32_t> &files);
+    // Returns false if fileId's Targets or Usrs FileMap definitely doesn't
+    // contain the (encoded) key
+    bool mayContain(FileMapType type, uint32_t fileId, const String &key);
+    BloomFilterCache::Stats bloomFilterStats() const { return mBloomFilterCache->stats(); }
+    // Containers stay mapped between queries until their file is rewritten
+    // or they're evicted, null if disabled.
+    std::shared_ptr<FileMapCache> fileMapCache() const { return mFileMapCache; }
 
     Path sourceFilePath(uint32_t fileId, const char *path = "") const;
 
@@ -235,8 +265,14 @@ public:
         serializer << mVisitedFiles;
     }
 
+    // FileMap scopes are per thread, see sFileMapScope
     void beginScope();
     void endScope();
+    // A read-only view of the dependency graph and file id indexes for
+    // queries running on Server's query thread pool. It shares the immutable
+    // parts with the project. Must be called and released on the main thread.
+    std::shared_ptr<Project> snapshot();
+    bool isSnapshot() const { return mIsSnapshot; }
     void dirty(uint32_t fileId);
     bool save();
     void prepare(uint32_t fileId);
@@ -248,6 +284,13 @@ public:
     void fixPCH(Source &source);
     void includeCompletions(Flags<QueryMessage::Flag> flags, const std::shared_ptr<Connection> &conn, Source &&source) const;
     size_t bytesWritten() const { return mBytesWritten; }
+    // How long indexing fileId took recently in ms, the project's average
+    // for files that haven't been indexed yet. 0 if nothing is known.
+    uint32_t predictedIndexDuration(uint32_t fileId) const;
+    void recordIndexDuration(uint32_t fileId, uint32_t ms);
+    // Peak rp memory use while indexing fileId in bytes, same fallbacks
+    size_t predictedIndexMemory(uint32_t fileId) const;
+    void recordIndexMemory(uint32_t fileId, size_t bytes);
     void destroy() { mSaveDirty = false; }
     enum VisitResult {
         Stop,
@@ -273,16 +316,36 @@ public:
     void forEachSource(std::function<VisitResult(const Source &source)> cb) const { forEachSource(mIndexParseData, cb); }
     void forEachSource(std::function<VisitResult(Source &source)> cb) { forEachSource(mIndexParseData, cb); }
     void validateAll();
+    enum ValidateMode {
+        StatOnly, // checks expectedSize if it isn't 0
+        Validate
+    };
+    // fileMaps is fileId's FileMapContainer, safe to call from any thread
+    static bool validate(const Path &fileMaps, uint32_t fileId, ValidateMode mode, String *error = 0, uint32_t expectedSize = 0);
+    static bool validateFileMaps(const Path &path, String *error);
 private:
     void reloadCompileCommands();
     void onFileAddedOrModified(const Path &path);
     void watchFile(uint32_t fileId);
-    enum ValidateMode {
-        StatOnly,
-        Validate
-    };
-    bool validate(uint32_t fileId, ValidateMode mode, String *error = 0) const;
+    bool validate(uint32_t fileId, ValidateMode mode, String *error = 0, uint32_t expectedSize = 0) const;
+    // Fully validates the files' FileMaps on Server's verifier thread and
+    // dirties fileId if any of them are broken
+    void verifyFileMaps(uint32_t fileId, const Set<uint32_t> &files);
     void removeDependencies(uint32_t fileId);
+    bool loadFileIdIndexes();
+    bool saveFileIdIndexes();
+    // The keys of a file's fileIdIndexTypes FileMaps in FileMap order, by
+    // FileMapType. Read once per container so compaction doesn't have to
+    // load the dirty files again.
+    struct FileIdIndexKeys {
+        List<String> keys[Callers + 1];
+
+        size_t size() const;
+    };
+    static std::shared_ptr<const FileIdIndexKeys> readFileIdIndexKeys(const Path &container);
+    void setFileIdIndexKeys(uint32_t fileId, const std::shared_ptr<const FileIdIndexKeys> &keys);
+    Path fileIdIndexPath(FileMapType type) const { return mProjectFilePath.parentDir() + fileMapName(type); }
+    std::shared_ptr<FileMap<String, Set<uint32_t> > > &fileIdIndex(FileMapType type);
     void updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDataMessage> &msg);
     void loadFailed(uint32_t fileId);
     void updateFixIts(const Set<uint32_t> &visited, FixIts &fixIts);
@@ -293,14 +356,34 @@ private:
                        const std::shared_ptr<Connection> &wait = std::shared_ptr<Connection>());
     void onDirtyTimeout(Timer *);
 
+    // sections share one mapping, it goes away with the last FileMap using
+    // it. Shared between a scope and its probeFiles() workers.
+    struct ContainerCache {
+        ContainerCache()
+            : loadFailed(false)
+        {}
+        std::mutex mutex;
+        Hash<uint32_t, std::weak_ptr<FileMapContainer> > containers;
+        bool loadFailed;
+    };
+
     struct FileMapScope {
-        FileMapScope(const std::shared_ptr<Project> &proj, int m)
-            : project(proj), openedFiles(0), totalOpened(0), max(m), loadFailed(false)
+        FileMapScope(const std::shared_ptr<Project> &proj, int m,
+                     const std::shared_ptr<ContainerCache> &c = std::shared_ptr<ContainerCache>())
+            : project(proj), cache(c ? c : std::make_shared<ContainerCache>()), worker(static_cast<bool>(c)),
+              openedFiles(0), totalOpened(0), max(m), loadFailed(false)
         {}
         ~FileMapScope()
         {
+            std::unique_lock<std::mutex> lock(cache->mutex);
+            if (worker) {
+                cache->loadFailed = cache->loadFailed || loadFailed;
+                return;
+            }
+            const bool failed = loadFailed || cache->loadFailed;
+            lock.unlock();
             warning() << "Query opened" << totalOpened << "files for project" << project->path();
-            if (loadFailed)
+            if (failed)
                 project->validateAll();
         }
 
@@ -332,20 +415,48 @@ private:
 
         template <typename Key, typename Value>
         std::shared_ptr<FileMap<Key, Value> > openFileMap(FileMapType type, uint32_t fileId,
-                                                          Hash<uint32_t, std::shared_ptr<FileMap<Key, Value> > > &cache,
+                                                          Hash<uint32_t, std::shared_ptr<FileMap<Key, Value> > > &fileMaps,
                                                           String *errPtr)
         {
-            auto it = cache.find(fileId);
-            if (it != cache.end()) {
+            auto it = fileMaps.find(fileId);
+            if (it != fileMaps.end()) {
                 poke(type, fileId);
                 return it->second;
             }
-            const Path path = project->sourceFilePath(fileId, Project::fileMapName(type));
-            auto fileMap = std::make_shared<FileMap<Key, Value>>();
+            const Path path = project->sourceFilePath(fileId, FileMapContainer::fileName());
+            std::shared_ptr<FileMap<Key, Value> > fileMap;
             String err;
-            if (fileMap->load(path, project->fileMapOptions(), &err)) {
-                ++totalOpened;
-                cache[fileId] = fileMap;
+            std::shared_ptr<FileMapContainer> container;
+            {
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                container = cache->containers.value(fileId).lock();
+            }
+            if (!container && project->mFileMapCache && (container = project->mFileMapCache->find(fileId))) {
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                cache->containers[fileId] = container;
+            }
+            if (!container) {
+                const uint32_t generation = project->mFileMapCache ? project->mFileMapCache->generation(fileId) : 0;
+                container = std::make_shared<FileMapContainer>();
+                if (container->load(path, &err)) {
+                    ++totalOpened;
+                    std::lock_guard<std::mutex> lock(cache->mutex);
+                    std::weak_ptr<FileMapContainer> &cached = cache->containers[fileId];
+                    if (std::shared_ptr<FileMapContainer> other = cached.lock()) {
+                        container = other; // another worker got there first
+                    } else {
+                        cached = container;
+                        if (project->mFileMapCache)
+                            project->mFileMapCache->insert(fileId, container, generation);
+                    }
+                } else {
+                    container.reset();
+                }
+            }
+            if (container && !(fileMap = container->fileMap<Key, Value>(type)))
+                err = String::format<32>("Missing section %s", fileMapName(type));
+            if (fileMap) {
+                fileMaps[fileId] = fileMap;
                 auto entry = std::make_shared<LRUEntry>(type, fileId);
                 entryList.append(entry);
                 entryMap[entry->key] = entry;
@@ -374,6 +485,18 @@ private:
                         assert(tokens.contains(e->key.fileId));
                         tokens.remove(e->key.fileId);
                         break;
+                    case Subclasses:
+                        assert(subclasses.contains(e->key.fileId));
+                        subclasses.remove(e->key.fileId);
+                        break;
+                    case Callees:
+                        assert(callees.contains(e->key.fileId));
+                        callees.remove(e->key.fileId);
+                        break;
+                    case Callers:
+                        assert(callers.contains(e->key.fileId));
+                        callers.remove(e->key.fileId);
+                        break;
                     }
                     --openedFiles;
                 }
@@ -392,9 +515,12 @@ private:
 
         Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > symbolNames;
         Hash<uint32_t, std::shared_ptr<FileMap<Location, Symbol> > > symbols;
-        Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > targets, usrs;
+        Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > targets, usrs, subclasses;
         Hash<uint32_t, std::shared_ptr<FileMap<uint32_t, Token> > > tokens;
+        Hash<uint32_t, std::shared_ptr<FileMap<String, Set<String> > > > callees, callers;
         std::shared_ptr<Project> project;
+        const std::shared_ptr<ContainerCache> cache;
+        const bool worker;
         int openedFiles, totalOpened;
         const int max;
         bool loadFailed;
@@ -403,7 +529,31 @@ private:
         Map<LRUKey, std::shared_ptr<LRUEntry> > entryMap;
     };
 
-    std::shared_ptr<FileMapScope> mFileMapScope;
+    FileMapScope *fileMapScope() const
+    {
+        assert(sFileMapScope);
+        assert(sFileMapScope->project.get() == this);
+        return sFileMapScope;
+    }
+    static thread_local FileMapScope *sFileMapScope;
+
+    struct RestoreFile;
+    struct Restore;
+    class RestoreJob;
+    void onRestored(List<RestoreFile> &&files);
+    void onDirtyChecked(List<RestoreFile> &&files);
+    void finishRestore();
+
+    bool appendJournal();
+    void openJournal(bool truncate);
+    void closeJournal();
+    bool replayJournal();
+    void clearJournal();
+
+    void invalidateSnapshot() { mSnapshot.reset(); }
+    // queued until the graph is asked for next
+    void setIncludes(uint32_t fileId, List<uint32_t> &&includes);
+    void removeFromDependencyGraph(uint32_t fileId);
 
     const Path mPath, mSourceFilePathBase;
     Path mProjectFilePath, mSourcesFilePath;
@@ -428,11 +578,56 @@ private:
     FixIts mFixIts;
 
     Hash<uint32_t, DependencyNode*> mDependencies;
+    mutable std::shared_ptr<const DependencyGraph> mDependencyGraph;
+    // changes not applied to mDependencyGraph yet, the new includes go in
+    // before the removals
+    mutable Hash<uint32_t, List<uint32_t> > mDependencyGraphIncludes;
+    mutable Set<uint32_t> mDependencyGraphRemoved;
+    mutable std::mutex mDependencyGraphMutex;
     Set<uint32_t> mSuspendedFiles;
 
+    // Project wide key -> fileIds indexes over the symnames, targets, usrs,
+    // subclasses, callees and callers FileMaps. Files in mFileIdIndexDirty have
+    // been reindexed since they were written and are searched individually
+    // until the next compaction.
+    std::shared_ptr<FileMap<String, Set<uint32_t> > > mSymbolNameIndex, mTargetIndex, mUsrIndex, mSubclassIndex,
+        mCalleeIndex, mCallerIndex;
+    Set<uint32_t> mFileIdIndexDirty;
+    // The current keys of the mFileIdIndexDirty files that are still in the
+    // project. A file that couldn't be read has no entry.
+    Hash<uint32_t, std::shared_ptr<const FileIdIndexKeys> > mFileIdIndexKeys;
+    size_t mFileIdIndexKeysSize;
+    enum { MaxFileIdIndexKeysMemory = 64 * 1024 * 1024 };
+
+    enum { MaxBloomFilterMemory = 64 * 1024 * 1024 };
+    std::shared_ptr<BloomFilterCache> mBloomFilterCache;
+    std::shared_ptr<FileMapCache> mFileMapCache;
+
     size_t mBytesWritten;
+    Hash<uint32_t, uint32_t> mIndexDurations, mIndexMemory; // ms, kb
+    uint64_t mIndexDurationTotal, mIndexMemoryTotal;
     bool mSaveDirty;
 
+    // Between compactions save() appends what changed since the last save to
+    // project.journal instead of rewriting project and sources. The journal
+    // is only replayed if its generation matches the one in project. Each
+    // record is its size and checksum followed by the payload.
+    FILE *mJournal;
+    uint64_t mJournalGeneration;
+    size_t mJournalSize, mCompactedSize;
+    bool mJournalCompact; // sources changed, only a full save will do
+    Set<uint32_t> mJournalDependencies, mJournalDiagnostics, mJournalTimings;
+    Set<uint32_t> mJournalFileIdIndexDirty; // only compaction clears mFileIdIndexDirty
+    Set<uint32_t> mJournalVisited; // protected by mMutex
+    Hash<uint32_t, uint64_t> mJournalParsed;
+
+    // set by init() until restore() has finished
+    std::shared_ptr<Restore> mRestore;
+
+    std::shared_ptr<Project> mSnapshot;
+    std::weak_ptr<Project> mSnapshotOf;
+    bool mIsSnapshot;
+
     mutable std::mutex mMutex;
 };
 
@@ -450,6 +645,7 @@ inline bool Project::visitFile(uint32_t visitFileId, const Path &path, uint32_t
     assert(job);
     if (p.isEmpty()) {
         p = path;
+        mJournalVisited.insert(visitFileId);
         job->visited.insert(visitFileId);
         return true;
     }
@@ -463,6 +659,7 @@ inline void Project::releaseFileIds(const Set<uint32_t> &fileIds)
         for (const auto &f : fileIds) {
             // error() << "Returning files" << Location::path(f);
             mVisitedFiles.remove(f);
+            mJournalVisited.insert(f);
         }
     }
 }
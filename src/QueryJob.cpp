@@ -27,10 +27,9 @@
 QueryJob::QueryJob(const std::shared_ptr<QueryMessage> &query,
                    const std::shared_ptr<Project> &proj,
                    Flags<JobFlag> jobFlags)
-    : mAborted(false), mLinesWritten(0), mQueryMessage(query), mJobFlags(jobFlags), mProject(proj), mFileFilter(0)
+    : mAborted(false), mLinesWritten(0), mQueryMessage(query), mJobFlags(jobFlags), mProject(proj), mFileFilter(0),
+      mThreaded(false)
 {
-    if (mProject)
-        mProject->beginScope();
     assert(query);
     if (query->flags() & QueryMessage::SilentQuery)
         setJobFlag(QuietJob);
@@ -58,8 +57,6 @@ QueryJob::QueryJob(const std::shared_ptr<QueryMessage> &query,
 
 QueryJob::~QueryJob()
 {
-    if (mProject)
-        mProject->endScope();
 }
 
 bool QueryJob::write(const String &out, Flags<WriteFlag> flags)
@@ -96,7 +93,6 @@ bool QueryJob::write(const String &out, Flags<WriteFlag> flags)
 
 bool QueryJob::writeRaw(const String &out, Flags<WriteFlag> flags)
 {
-    assert(mConnection);
     if (!(flags & IgnoreMax) && mQueryMessage) {
         const int max = mQueryMessage->max();
         if (max != -1 && mLinesWritten == max) {
@@ -109,6 +105,16 @@ bool QueryJob::writeRaw(const String &out, Flags<WriteFlag> flags)
     if (!(mJobFlags & QuietJob))
         warning("=> %s", out.constData());
 
+    if (mThreaded) {
+        if (isAborted())
+            return false;
+        mPendingWrites.append(out);
+        if (mPendingWrites.size() >= MaxPendingWrites)
+            flushPendingWrites();
+        return true;
+    }
+
+    assert(mConnection);
     if (mConnection) {
         if (!mConnection->write(out)) {
             abort();
@@ -128,9 +134,9 @@ bool QueryJob::locationToString(Location location,
         return false;
     Flags<Location::ToStringFlag> kf = locationToStringFlags();
     kf &= ~Location::ShowContext;
-    cb(Piece_Location, location.toString(kf, &mContextCache));
+    cb(Piece_Location, location.toString(kf, &mContextCache, mProject.get()));
     if (!(writeFlags & NoContext) && !(queryFlags() & QueryMessage::NoContext))
-        cb(Piece_Context, location.context(kf, &mContextCache));
+        cb(Piece_Context, location.context(kf, &mContextCache, mProject.get()));
 
     const bool containingFunction = queryFlags() & QueryMessage::ContainingFunction;
     const bool containingFunctionLocation = queryFlags() & QueryMessage::ContainingFunctionLocation;
@@ -165,7 +171,7 @@ bool QueryJob::locationToString(Location location,
                             if (containingFunction)
                                 cb(Piece_ContainingFunctionName, symbol.symbolName);
                             if (containingFunctionLocation)
-                                cb(Piece_ContainingFunctionLocation, symbol.location.toString(locationToStringFlags() & ~Location::ShowContext));
+                                cb(Piece_ContainingFunctionLocation, symbol.location.toString(locationToStringFlags() & ~Location::ShowContext, 0, mProject.get()));
                             break;
                         }
                     }
@@ -284,11 +290,48 @@ int QueryJob::run(const std::shared_ptr<Connection> &connection)
 {
     assert(connection);
     mConnection = connection;
+    if (mProject)
+        mProject->beginScope();
     const int ret = execute();
+    if (mProject)
+        mProject->endScope();
     mConnection = 0;
     return ret;
 }
 
+int QueryJob::runInThread(const std::weak_ptr<Connection> &connection)
+{
+    assert(!EventLoop::isMainThread());
+    mThreaded = true;
+    mThreadConnection = connection;
+    if (mProject)
+        mProject->beginScope();
+    const int ret = execute();
+    if (mProject)
+        mProject->endScope();
+    flushPendingWrites();
+    mThreadConnection.reset();
+    mThreaded = false;
+    return ret;
+}
+
+void QueryJob::flushPendingWrites()
+{
+    if (mPendingWrites.isEmpty())
+        return;
+    const List<String> lines = std::move(mPendingWrites);
+    mPendingWrites.clear();
+    std::weak_ptr<Connection> conn = mThreadConnection;
+    EventLoop::mainEventLoop()->callLater([conn, lines]() {
+            if (auto c = conn.lock()) {
+                for (const String &line : lines) {
+                    if (!c->write(line))
+                        break;
+                }
+            }
+        });
+}
+
 bool QueryJob::filterLocation(Location loc) const
 {
     if (mFileFilter && loc.fileId() != mFileFilter)
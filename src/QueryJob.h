@@ -94,6 +94,9 @@ public:
     std::shared_ptr<Project> project() const { return mProject; }
     virtual int execute() = 0;
     int run(const std::shared_ptr<Connection> &connection = 0);
+    // Runs the job on a query thread. Output is posted to the main thread
+    // in batches, the caller finishes the connection.
+    int runInThread(const std::weak_ptr<Connection> &connection);
     bool isAborted() const { std::lock_guard<std::mutex> lock(mMutex); return mAborted; }
     void abort() { std::lock_guard<std::mutex> lock(mMutex); mAborted = true; }
     std::mutex &mutex() const { return mMutex; }
@@ -138,6 +141,8 @@ private:
     bool mAborted;
     int mLinesWritten;
     bool writeRaw(const String &out, Flags<WriteFlag> flags);
+    void flushPendingWrites();
+    enum { MaxPendingWrites = 256 };
     std::shared_ptr<QueryMessage> mQueryMessage;
     Flags<JobFlag> mJobFlags;
     Signal<std::function<void(const String &)> > mOutput;
@@ -149,6 +154,9 @@ private:
     String mBuffer;
     std::shared_ptr<Connection> mConnection;
     Hash<Path, String> mContextCache;
+    bool mThreaded;
+    std::weak_ptr<Connection> mThreadConnection;
+    List<String> mPendingWrites;
 };
 
 RCT_FLAGS(QueryJob::JobFlag);
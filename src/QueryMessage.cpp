@@ -19,7 +19,7 @@
 #include "RTags.h"
 
 QueryMessage::QueryMessage(Type type)
-    : RTagsMessage(MessageId), mType(type), mMax(-1), mMinLine(-1), mMaxLine(-1), mBuildIndex(0), mTerminalWidth(-1)
+    : RTagsMessage(MessageId), mType(type), mMax(-1), mMinLine(-1), mMaxLine(-1), mBuildIndex(0), mTerminalWidth(-1), mCallDepth(1)
 {
 }
 
@@ -27,7 +27,7 @@ void QueryMessage::encode(Serializer &serializer) const
 {
     serializer << mCommandLine << mQuery << mCodeCompletePrefix << mType << mFlags << mMax
                << mMinLine << mMaxLine << mBuildIndex << mPathFilters << mKindFilters
-               << mCurrentFile << mUnsavedFiles << mTerminalWidth
+               << mCurrentFile << mUnsavedFiles << mTerminalWidth << mCallDepth
 #ifdef RTAGS_HAS_LUA
                << mVisitASTScripts
 #endif
@@ -38,7 +38,7 @@ void QueryMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mCommandLine >> mQuery >> mCodeCompletePrefix >> mType >> mFlags >> mMax
                  >> mMinLine >> mMaxLine >> mBuildIndex >> mPathFilters >> mKindFilters
-                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth
+                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth >> mCallDepth
 #ifdef RTAGS_HAS_LUA
                  >> mVisitASTScripts
 #endif
@@ -33,6 +33,7 @@ public:
     enum Type {
         Invalid,
         GenerateTest,
+        CallTree,
         CheckReindex,
         ClassHierarchy,
         ClearProjects,
@@ -123,7 +124,8 @@ public:
         CodeCompletionEnabled = (1ull << 43),
         SynchronousDiagnostics = (1ull << 44),
         CodeCompleteNoWait = (1ull << 45),
-        AllTargets = (1ull << 46)
+        AllTargets = (1ull << 46),
+        Callees = (1ull << 47)
     };
 
     QueryMessage(Type type = Invalid);
@@ -211,6 +213,9 @@ public:
     int max() const { return mMax; }
     void setMax(int max) { mMax = max; }
 
+    int callDepth() const { return mCallDepth; }
+    void setCallDepth(int depth) { mCallDepth = depth; }
+
     Flags<Flag> flags() const { return mFlags; }
     void setFlags(Flags<Flag> flags)
     {
@@ -251,7 +256,7 @@ private:
     KindFilters mKindFilters;
     Path mCurrentFile;
     UnsavedFiles mUnsavedFiles;
-    int mTerminalWidth;
+    int mTerminalWidth, mCallDepth;
 #ifdef RTAGS_HAS_LUA
     List<String> mVisitASTScripts;
 #endif
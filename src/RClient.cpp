@@ -108,6 +108,9 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::RemoveBuffers, "remove-buffers", 0, CommandLineParser::Required, "Remove buffers." },
     { RClient::ListCursorKinds, "list-cursor-kinds", 0, CommandLineParser::NoValue, "List spelling for known cursor kinds." },
     { RClient::ClassHierarchy, "class-hierarchy", 0, CommandLineParser::Required, "Dump class hierarcy for struct/class at location." },
+    { RClient::Callers, "callers", 0, CommandLineParser::Required, "Dump the functions calling the function at location." },
+    { RClient::Callees, "callees", 0, CommandLineParser::Required, "Dump the functions called by the function at location." },
+    { RClient::CallDepth, "call-depth", 0, CommandLineParser::Required, "Levels of callers/callees to dump for --callers and --callees (default 1)." },
     { RClient::DebugLocations, "debug-locations", 0, CommandLineParser::Optional, "Manipulate debug locations." },
 #ifdef RTAGS_HAS_LUA
     { RClient::VisitAST, "visit-ast", 0, CommandLineParser::Required, "Visit AST of a source file." },
@@ -211,6 +214,7 @@ public:
         msg.setUnsavedFiles(rc->unsavedFiles());
         msg.setFlags(extraQueryFlags | rc->queryFlags());
         msg.setMax(rc->max());
+        msg.setCallDepth(rc->callDepth());
         msg.setPathFilters(rc->pathFilters());
         msg.setKindFilters(rc->kindFilters());
         msg.setRangeFilter(rc->minOffset(), rc->maxOffset());
@@ -320,7 +324,7 @@ public:
 
 RClient::RClient()
     : mMax(-1), mTimeout(-1), mMinOffset(-1), mMaxOffset(-1),
-      mConnectTimeout(DEFAULT_CONNECT_TIMEOUT), mBuildIndex(0),
+      mConnectTimeout(DEFAULT_CONNECT_TIMEOUT), mBuildIndex(0), mCallDepth(1),
       mLogLevel(LogLevel::Error), mTcpPort(0), mGuessFlags(false),
       mTerminalWidth(-1), mExitCode(RTags::ArgumentParseError)
 {
@@ -682,6 +686,13 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
                 return { String::format<1024>("--connect-timeout [arg] must be >= 0"), CommandLineParser::Parse_Error };
             }
             break; }
+        case CallDepth: {
+            bool ok;
+            mCallDepth = value.toULongLong(&ok);
+            if (!ok || mCallDepth <= 0) {
+                return { String::format<1024>("--call-depth [arg] must be > 0"), CommandLineParser::Parse_Error };
+            }
+            break; }
         case Max: {
             bool ok;
             mMax = value.toULongLong(&ok);
@@ -727,12 +738,15 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             break; }
         case FollowLocation:
         case ClassHierarchy:
+        case Callers:
+        case Callees:
         case ReferenceLocation: {
             String encoded = Location::encode(value);
             if (encoded.isEmpty()) {
                 return { String::format<1024>("Can't resolve argument %s", value.constData()), CommandLineParser::Parse_Error };
             }
             QueryMessage::Type queryType = QueryMessage::Invalid;
+            Flags<QueryMessage::Flag> extraQueryFlags = QueryMessage::HasLocation;
             switch (type) {
             case FollowLocation:
                 queryType = QueryMessage::FollowLocation;
@@ -743,11 +757,17 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             case ClassHierarchy:
                 queryType = QueryMessage::ClassHierarchy;
                 break;
+            case Callees:
+                extraQueryFlags |= QueryMessage::Callees;
+                // fall through
+            case Callers:
+                queryType = QueryMessage::CallTree;
+                break;
             default:
                 assert(0);
                 break;
             }
-            addQuery(queryType, std::move(encoded), QueryMessage::HasLocation);
+            addQuery(queryType, std::move(encoded), extraQueryFlags);
             break; }
         case SymbolInfo: {
             std::cmatch match;
@@ -39,6 +39,9 @@ public:
         AllReferences,
         AllTargets,
         BuildIndex,
+        CallDepth,
+        Callees,
+        Callers,
         CheckIncludes,
         CheckReindex,
         ClassHierarchy,
@@ -169,6 +172,7 @@ public:
     LogLevel logLevel() const { return mLogLevel; }
     int timeout() const { return mTimeout; }
     int buildIndex() const { return mBuildIndex; }
+    int callDepth() const { return mCallDepth; }
 
     const Set<QueryMessage::PathFilter> &pathFilters() const { return mPathFilters; }
     int minOffset() const { return mMinOffset; }
@@ -205,7 +209,7 @@ private:
     void addCompile(Path &&compileCommands);
 
     Flags<QueryMessage::Flag> mQueryFlags;
-    int mMax, mTimeout, mMinOffset, mMaxOffset, mConnectTimeout, mBuildIndex;
+    int mMax, mTimeout, mMinOffset, mMaxOffset, mConnectTimeout, mBuildIndex, mCallDepth;
     LogLevel mLogLevel;
     Set<QueryMessage::PathFilter> mPathFilters;
     QueryMessage::KindFilters mKindFilters;
@@ -18,6 +18,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <string.h>
 #include <sys/types.h>
 #ifdef OS_FreeBSD
 #include <sys/sysctl.h>
@@ -84,6 +85,42 @@ void decodePath(Path &path)
 }
 
 
+// MurmurHash64A
+uint64_t contentHash(const char *data, size_t size)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    uint64_t h = 0x8445d61a4e774912ull ^ (size * m);
+
+    const char *end = data + (size & ~static_cast<size_t>(7));
+    while (data != end) {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        data += sizeof(k);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (size & 7) {
+    case 7: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[6])) << 48; // fall through
+    case 6: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[5])) << 40; // fall through
+    case 5: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[4])) << 32; // fall through
+    case 4: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[3])) << 24; // fall through
+    case 3: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[2])) << 16; // fall through
+    case 2: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[1])) << 8; // fall through
+    case 1: h ^= static_cast<uint64_t>(static_cast<unsigned char>(data[0]));
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h ? h : 1;
+}
+
 Path encodeSourceFilePath(const Path &dataDir, const Path &project, uint32_t fileId)
 {
     String str = dataDir;
@@ -511,12 +548,18 @@ String cursorToString(CXCursor cursor, Flags<CursorToStringFlags> flags)
 std::shared_ptr<TranslationUnit> TranslationUnit::create(const Path &sourceFile, const List<String> &args,
                                                          CXUnsavedFile *unsaved, int unsavedCount,
                                                          Flags<CXTranslationUnit_Flags> translationUnitFlags,
-                                                         bool displayDiagnostics)
+                                                         bool displayDiagnostics,
+                                                         CXIndex index)
 
 {
     auto ret = std::make_shared<TranslationUnit>();
     ret->clangLine = "clang ";
-    ret->index = clang_createIndex(0, displayDiagnostics);
+    if (index) {
+        ret->index = index;
+        ret->ownsIndex = false;
+    } else {
+        ret->index = clang_createIndex(0, displayDiagnostics);
+    }
 
     int idx = 0;
     List<const char*> clangArgs(args.size() + 2, 0);
@@ -138,13 +138,13 @@ RCT_FLAGS(CXTranslationUnit_Flags);
 
 struct TranslationUnit {
     TranslationUnit()
-        : index(0), unit(0)
+        : index(0), unit(0), ownsIndex(true)
     {}
     ~TranslationUnit()
     {
         if (unit)
             clang_disposeTranslationUnit(unit);
-        if (index)
+        if (index && ownsIndex)
             clang_disposeIndex(index);
     }
     static void visit(CXCursor c, std::function<CXChildVisitResult(CXCursor)> func)
@@ -166,10 +166,12 @@ struct TranslationUnit {
                                                    CXUnsavedFile *unsaved,
                                                    int unsavedCount,
                                                    Flags<CXTranslationUnit_Flags> translationUnitFlags = CXTranslationUnit_None,
-                                                   bool displayDiagnostics = true);
+                                                   bool displayDiagnostics = true,
+                                                   CXIndex index = 0); // a passed index is the caller's to dispose
 
     CXIndex index;
     CXTranslationUnit unit;
+    bool ownsIndex;
     String clangLine;
 };
 
@@ -543,6 +545,10 @@ struct SortedSymbol
 
 Path encodeSourceFilePath(const Path &dataDir, const Path &project, uint32_t fileId = 0);
 
+// Fast non-cryptographic 64 bit hash of file contents, never returns 0
+uint64_t contentHash(const char *data, size_t size);
+inline uint64_t contentHash(const String &data) { return contentHash(data.constData(), data.size()); }
+
 template <typename Container, typename Value>
 inline bool addTo(Container &container, const Value &value)
 {
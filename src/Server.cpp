@@ -24,9 +24,11 @@
 #include <limits>
 #include <regex>
 
+#include "CallTreeJob.h"
 #include "ClassHierarchyJob.h"
 #include "CompletionThread.h"
 #include "DependenciesJob.h"
+#include "DependencyGraph.h"
 #include "ClangThread.h"
 #include "FileManager.h"
 #include "Filter.h"
@@ -92,7 +94,8 @@ static const List<Path> sSystemIncludePaths = {
 
 Server *Server::sInstance = 0;
 Server::Server()
-    : mSuspended(false), mEnvironment(Rct::environment()), mPollTimer(-1), mExitCode(0), mLastFileId(0), mCompletionThread(0)
+    : mSuspended(false), mEnvironment(Rct::environment()), mPollTimer(-1), mExitCode(0), mLastFileId(0),
+      mFileIdsJournal(0), mFileIdsJournalEntries(0), mFileIdsCompactedCount(0), mCompletionThread(0)
 {
     assert(!sInstance);
     sInstance = this;
@@ -110,7 +113,12 @@ Server::~Server()
         mCompletionThread = 0;
     }
 
+    mQueryThreadPool.reset();
+    mProbeThreadPool.reset();
+    mVerifyThreadPool.reset();
+    mRestoreThreadPool.reset();
     stopServers();
+    closeFileIdsJournal();
     mProjects.clear(); // need to be destroyed before sInstance is set to 0
     assert(sInstance == this);
     sInstance = 0;
@@ -194,6 +202,12 @@ bool Server::init(const Options &options)
     }
 
     mJobScheduler.reset(new JobScheduler);
+    if (mOptions.queryThreads > 0)
+        mQueryThreadPool = std::make_shared<ThreadPool>(mOptions.queryThreads);
+    if (mOptions.probeThreads > 1)
+        mProbeThreadPool = std::make_shared<ThreadPool>(mOptions.probeThreads);
+    mVerifyThreadPool = std::make_shared<ThreadPool>(1);
+    mRestoreThreadPool = std::make_shared<ThreadPool>(std::max(2, ThreadPool::idealThreadCount()));
 
     if (!load())
         return false;
@@ -325,13 +339,15 @@ bool Server::initServers()
     return true;
 }
 
-std::shared_ptr<Project> Server::addProject(const Path &path)
+std::shared_ptr<Project> Server::addProject(const Path &path, bool restore)
 {
     std::shared_ptr<Project> &project = mProjects[path];
     if (!project) {
         project.reset(new Project(path));
         project->init();
     }
+    if (restore)
+        project->restore();
     return project;
 }
 
@@ -766,6 +782,9 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
     case QueryMessage::ClassHierarchy:
         classHierarchy(message, conn);
         break;
+    case QueryMessage::CallTree:
+        callTree(message, conn);
+        break;
     case QueryMessage::DebugLocations:
         debugLocations(message, conn);
         break;
@@ -1096,9 +1115,7 @@ void Server::symbolInfo(const std::shared_ptr<QueryMessage> &query, const std::s
     const Location start(fileId, line, column);
     const Location end = line2 ? Location(fileId, line2, column2) : Location();
 
-    SymbolInfoJob job(start, end, std::move(kinds), query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    runQueryJob(std::make_shared<SymbolInfoJob>(start, end, std::move(kinds), query, queryProject(project)), conn);
 }
 
 void Server::dependencies(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1181,9 +1198,7 @@ void Server::referencesForLocation(const std::shared_ptr<QueryMessage> &query, c
         return;
     }
 
-    ReferencesJob job(loc, query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    runQueryJob(std::make_shared<ReferencesJob>(loc, query, queryProject(project)), conn);
 }
 
 void Server::referencesForName(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1200,9 +1215,7 @@ void Server::referencesForName(const std::shared_ptr<QueryMessage> &query, const
         return;
     }
 
-    ReferencesJob job(name, query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    runQueryJob(std::make_shared<ReferencesJob>(name, query, queryProject(project)), conn);
 }
 
 void Server::findSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1213,15 +1226,13 @@ void Server::findSymbols(const std::shared_ptr<QueryMessage> &query, const std::
     if (!project)
         project = currentProject();
 
-    int ret = 0;
     if (!project) {
-        ret = 1;
         error("No project");
-    } else {
-        FindSymbolsJob job(query, project);
-        ret = job.run(conn);
+        conn->finish(1);
+        return;
     }
-    conn->finish(ret);
+
+    runQueryJob(std::make_shared<FindSymbolsJob>(query, queryProject(project)), conn);
 }
 
 void Server::listSymbols(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1238,9 +1249,7 @@ void Server::listSymbols(const std::shared_ptr<QueryMessage> &query, const std::
         return;
     }
 
-    ListSymbolsJob job(query, project);
-    const int ret = job.run(conn);
-    conn->finish(ret);
+    runQueryJob(std::make_shared<ListSymbolsJob>(query, queryProject(project)), conn);
 }
 
 void Server::status(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1353,6 +1362,7 @@ void Server::preprocessFile(const std::shared_ptr<QueryMessage> &query, const st
 
 void Server::clearProjects(ClearMode mode)
 {
+    closeFileIdsJournal();
     Path::rmdir(mOptions.dataDir);
     setCurrentProject(std::shared_ptr<Project>());
     for (auto p : mProjects) {
@@ -1427,6 +1437,7 @@ void Server::setCurrentProject(const std::shared_ptr<Project> &project)
             old->fileManager()->clearFileSystemWatcher();
         mCurrentProject = project;
         if (project) {
+            project->restore();
             Path::mkdir(mOptions.dataDir);
             FILE *f = fopen((mOptions.dataDir + ".currentProject").constData(), "w");
             if (f) {
@@ -1656,22 +1667,20 @@ void Server::sources(const std::shared_ptr<QueryMessage> &query, const std::shar
                 SourceList sources = project->sources(fileId);
                 if (sources.isEmpty() && path.isHeader()) {
                     Set<uint32_t> seen;
-                    std::function<uint32_t(uint32_t)> findSourceFileId = [&findSourceFileId, &project, &seen](uint32_t file) {
-                        DependencyNode *node = project->dependencyNode(file);
+                    const std::shared_ptr<const DependencyGraph> graph = project->dependencyGraph();
+                    std::function<uint32_t(uint32_t)> findSourceFileId = [&findSourceFileId, &graph, &seen](uint32_t file) {
                         uint32_t ret = 0;
-                        if (node) {
-                            for (const auto &dep : node->dependents) {
-                                if (!seen.insert(dep.first))
-                                    continue;
-
-                                if (Location::path(dep.first).isSource()) {
-                                    ret = dep.first;
+                        for (uint32_t dep : graph->edges(file, DependencyGraph::Dependents)) {
+                            if (!seen.insert(dep))
+                                continue;
+
+                            if (Location::path(dep).isSource()) {
+                                ret = dep;
+                                break;
+                            } else {
+                                ret  = findSourceFileId(dep);
+                                if (ret)
                                     break;
-                                } else {
-                                    ret  = findSourceFileId(dep.first);
-                                    if (ret)
-                                        break;
-                                }
                             }
                         }
                         return ret;
@@ -1893,8 +1902,82 @@ void Server::classHierarchy(const std::shared_ptr<QueryMessage> &query, const st
         return;
     }
 
-    ClassHierarchyJob job(loc, query, project);
-    conn->finish(job.run(conn));
+    runQueryJob(std::make_shared<ClassHierarchyJob>(loc, query, queryProject(project)), conn);
+}
+
+void Server::callTree(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
+{
+    const Location loc = query->location();
+    if (loc.isNull()) {
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+    std::shared_ptr<Project> project = projectForQuery(query);
+    if (!project) {
+        error("No project");
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+
+    if (!project->dependencies().contains(loc.fileId())) {
+        conn->write("Not indexed");
+        conn->finish(RTags::NotIndexed);
+        return;
+    }
+
+    runQueryJob(std::make_shared<CallTreeJob>(loc, query, queryProject(project)), conn);
+}
+
+class QueryThreadJob : public ThreadPool::Job
+{
+public:
+    QueryThreadJob(const std::shared_ptr<QueryJob> &job, const std::shared_ptr<Connection> &conn, unsigned int key)
+        : mJob(job), mConnection(conn), mKey(key)
+    {}
+
+protected:
+    virtual void run() override
+    {
+        const int ret = mJob->runInThread(mConnection);
+        // The job owns a project snapshot which has to be destroyed on the
+        // main thread. Output posted by runInThread is delivered before this.
+        std::shared_ptr<QueryJob> *job = new std::shared_ptr<QueryJob>(std::move(mJob));
+        std::weak_ptr<Connection> conn = mConnection;
+        const unsigned int key = mKey;
+        EventLoop::mainEventLoop()->callLater([job, conn, key, ret]() {
+                delete job;
+                if (std::shared_ptr<Connection> c = conn.lock()) {
+                    c->disconnected().disconnect(key);
+                    c->finish(ret);
+                }
+            });
+    }
+
+private:
+    std::shared_ptr<QueryJob> mJob;
+    std::weak_ptr<Connection> mConnection;
+    const unsigned int mKey;
+};
+
+std::shared_ptr<Project> Server::queryProject(const std::shared_ptr<Project> &project)
+{
+    return mQueryThreadPool ? project->snapshot() : project;
+}
+
+void Server::runQueryJob(const std::shared_ptr<QueryJob> &job, const std::shared_ptr<Connection> &conn)
+{
+    if (!mQueryThreadPool) {
+        conn->finish(job->run(conn));
+        return;
+    }
+    std::weak_ptr<QueryJob> weak = job;
+    const unsigned int key = conn->disconnected().connect([weak](const std::shared_ptr<Connection> &) {
+            if (std::shared_ptr<QueryJob> j = weak.lock())
+                j->abort();
+        });
+    mQueryThreadPool->start(std::make_shared<QueryThreadJob>(job, conn, key));
 }
 
 void Server::debugLocations(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn)
@@ -1970,17 +2053,24 @@ void Server::validate(const std::shared_ptr<QueryMessage> &query, const std::sha
 
 void Server::handleVisitFileMessage(const std::shared_ptr<VisitFileMessage> &message, const std::shared_ptr<Connection> &conn)
 {
-    uint32_t fileId = 0;
-    bool visit = false;
+    const List<Path> &files = message->files();
+    List<uint32_t> fileIds;
+    fileIds.resize(files.size(), 0);
+    Set<uint32_t> visit;
 
     std::shared_ptr<Project> project = mProjects.value(message->project());
     const uint32_t id = message->sourceFileId();
     if (project && project->isActiveJob(id)) {
-        assert(message->file() == message->file().resolved());
-        fileId = Location::insertFile(message->file());
-        visit = project->visitFile(fileId, message->file(), id);
+        for (size_t i=0; i<files.size(); ++i) {
+            const Path &file = files.at(i);
+            assert(file == file.resolved());
+            const uint32_t fileId = Location::insertFile(file);
+            fileIds[i] = fileId;
+            if (project->visitFile(fileId, file, id))
+                visit.insert(fileId);
+        }
     }
-    VisitFileResponseMessage msg(fileId, visit);
+    VisitFileResponseMessage msg(fileIds, visit);
     conn->send(msg);
 }
 
@@ -2004,6 +2094,26 @@ bool Server::load()
         Hash<Path, uint32_t> pathsToIds;
         fileIdsFile >> pathsToIds;
 
+        // replay ids added since fileids was last written, a truncated
+        // record at the end means we crashed while appending it
+        const String journal = Path(mOptions.dataDir + "fileids.journal").readAll();
+        int version;
+        if (journal.size() >= sizeof(version)) {
+            memcpy(&version, journal.constData(), sizeof(version));
+            if (version == RTags::DatabaseVersion) {
+                size_t pos = sizeof(version);
+                uint32_t header[2]; // id, size
+                while (pos + sizeof(header) <= journal.size()) {
+                    memcpy(header, journal.constData() + pos, sizeof(header));
+                    pos += sizeof(header);
+                    if (pos + header[1] > journal.size())
+                        break;
+                    pathsToIds[String(journal.constData() + pos, header[1])] = header[0];
+                    pos += header[1];
+                }
+            }
+        }
+
         Sandbox::decode(pathsToIds);
 
         Location::init(pathsToIds);
@@ -2030,7 +2140,7 @@ bool Server::load()
                                   file.constData());
                             remove = true;
                         } else {
-                            addProject(filePath.ensureTrailingSlash());
+                            addProject(filePath.ensureTrailingSlash(), false);
                         }
                     } else {
                         remove = true;
@@ -2086,9 +2196,35 @@ bool Server::load()
 
 bool Server::saveFileIds()
 {
+    std::lock_guard<std::mutex> lock(mFileIdsMutex);
     const uint32_t lastId = Location::lastId();
     if (mLastFileId == lastId)
         return true;
+    if (!mFileIdsJournal || mFileIdsJournalEntries >= std::max<uint32_t>(1024, mFileIdsCompactedCount))
+        return compactFileIds(lastId);
+
+    String records;
+    for (uint32_t id = mLastFileId + 1; id <= lastId; ++id) {
+        const Path path = Sandbox::encoded(Location::path(id));
+        if (path.isEmpty())
+            continue;
+        const uint32_t header[] = { id, static_cast<uint32_t>(path.size()) };
+        records.append(reinterpret_cast<const char*>(header), sizeof(header));
+        records.append(path);
+        ++mFileIdsJournalEntries;
+    }
+    if (!fwrite(records.constData(), records.size(), 1, mFileIdsJournal) || fflush(mFileIdsJournal)) {
+        error("Can't append to file ids journal: %s", Rct::strerror().constData());
+        return compactFileIds(lastId);
+    }
+
+    mLastFileId = lastId;
+    return true;
+}
+
+bool Server::compactFileIds(uint32_t lastId)
+{
+    closeFileIdsJournal();
     DataFile fileIdsFile(mOptions.dataDir + "fileids", RTags::DatabaseVersion);
     if (!fileIdsFile.open(DataFile::Write)) {
         error("Can't save file ids: %s", fileIdsFile.error().constData());
@@ -2106,9 +2242,32 @@ bool Server::saveFileIds()
     }
 
     mLastFileId = lastId;
+    mFileIdsCompactedCount = Location::count();
+
+    // fileids is complete now so the journal starts over
+    const Path journal = mOptions.dataDir + "fileids.journal";
+    mFileIdsJournal = fopen(journal.constData(), "w");
+    if (!mFileIdsJournal) {
+        error("Can't open file ids journal: %s", Rct::strerror().constData());
+        return true;
+    }
+    const int version = RTags::DatabaseVersion;
+    if (!fwrite(&version, sizeof(version), 1, mFileIdsJournal) || fflush(mFileIdsJournal)) {
+        closeFileIdsJournal();
+        Path::rm(journal);
+    }
     return true;
 }
 
+void Server::closeFileIdsJournal()
+{
+    if (mFileIdsJournal) {
+        fclose(mFileIdsJournal);
+        mFileIdsJournal = 0;
+    }
+    mFileIdsJournalEntries = 0;
+}
+
 void Server::removeSocketFile()
 {
 #ifdef RTAGS_HAS_LAUNCHD
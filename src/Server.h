@@ -16,6 +16,9 @@
 #ifndef Server_h
 #define Server_h
 
+#include <stdio.h>
+#include <mutex>
+
 #include "IndexMessage.h"
 #include "rct/Flags.h"
 #include "rct/Hash.h"
@@ -44,6 +47,7 @@ class Message;
 class OutputMessage;
 class Project;
 class QueryMessage;
+class ThreadPool;
 class VisitFileMessage;
 class JobScheduler;
 class IndexParseData;
@@ -94,7 +98,8 @@ public:
               rpVisitFileTimeout(0), rpIndexDataMessageTimeout(0), rpConnectTimeout(0),
               rpConnectAttempts(0), rpNiceValue(0), maxCrashCount(0),
               completionCacheSize(0), testTimeout(60 * 1000 * 5),
-              maxFileMapScopeCacheSize(512), pollTimer(0), tcpPort(0)
+              maxFileMapScopeCacheSize(512), maxFileMapCacheMemory(0), pollTimer(0), rpJobsPerProcess(1),
+              rpMaxMemory(0), queryThreads(0), probeThreads(0), representativeSources(0), jobMemoryBudget(0), tcpPort(0)
         {
         }
 
@@ -103,8 +108,8 @@ public:
         size_t jobCount, headerErrorJobCount, maxIncludeCompletionDepth;
         int rpVisitFileTimeout, rpIndexDataMessageTimeout,
             rpConnectTimeout, rpConnectAttempts, rpNiceValue, maxCrashCount,
-            completionCacheSize, testTimeout, maxFileMapScopeCacheSize, errorLimit,
-            pollTimer;
+            completionCacheSize, testTimeout, maxFileMapScopeCacheSize, maxFileMapCacheMemory, errorLimit,
+            pollTimer, rpJobsPerProcess, rpMaxMemory, queryThreads, probeThreads, representativeSources, jobMemoryBudget;
         uint16_t tcpPort;
         List<String> defaultArguments, excludeFilters;
         Set<String> blockedArguments;
@@ -124,6 +129,9 @@ public:
     void stopServers();
     void dumpJobs(const std::shared_ptr<Connection> &conn);
     std::shared_ptr<JobScheduler> jobScheduler() const { return mJobScheduler; }
+    std::shared_ptr<ThreadPool> probeThreadPool() const { return mProbeThreadPool; }
+    std::shared_ptr<ThreadPool> verifyThreadPool() const { return mVerifyThreadPool; }
+    std::shared_ptr<ThreadPool> restoreThreadPool() const { return mRestoreThreadPool; }
     const Set<uint32_t> &activeBuffers() const { return mActiveBuffers; }
     bool isActiveBuffer(uint32_t fileId) const { return mActiveBuffers.contains(fileId); }
     int exitCode() const { return mExitCode; }
@@ -141,6 +149,8 @@ public:
         HasSandboxRoot = 0x1
     };
 private:
+    bool compactFileIds(uint32_t lastId);
+    void closeFileIdsJournal();
     String guessArguments(const String &args, const Path &pwd, const Path &projectRootOverride) const;
     bool load();
     void onNewConnection(SocketServer *server);
@@ -192,17 +202,24 @@ private:
     void suspend(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void setBuffers(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void classHierarchy(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
+    void callTree(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void debugLocations(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void tokens(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
     void validate(const std::shared_ptr<QueryMessage> &query, const std::shared_ptr<Connection> &conn);
 
     std::shared_ptr<Project> projectForQuery(const std::shared_ptr<QueryMessage> &queryMessage);
     std::shared_ptr<Project> projectForMatches(const List<Match> &matches);
-    std::shared_ptr<Project> addProject(const Path &path);
+    // projects loaded at startup aren't restored until they're made current
+    std::shared_ptr<Project> addProject(const Path &path, bool restore = true);
 
     bool initServers();
     void removeSocketFile();
     void prepareCompletion(const std::shared_ptr<QueryMessage> &query, uint32_t fileId, const std::shared_ptr<Project> &project);
+    // Runs the job on mQueryThreadPool if there is one and finishes the
+    // connection when it's done. The job must be created with
+    // queryProject(project).
+    std::shared_ptr<Project> queryProject(const std::shared_ptr<Project> &project);
+    void runQueryJob(const std::shared_ptr<QueryJob> &job, const std::shared_ptr<Connection> &conn);
 
     typedef Hash<Path, std::shared_ptr<Project> > ProjectsMap;
     ProjectsMap mProjects;
@@ -216,7 +233,14 @@ private:
 
     int mPollTimer, mExitCode;
     uint32_t mLastFileId;
+    // new file ids are appended to fileids.journal and folded into fileids
+    // once the journal has grown as large as the table was when it was last
+    // written
+    FILE *mFileIdsJournal;
+    uint32_t mFileIdsJournalEntries, mFileIdsCompactedCount;
+    std::mutex mFileIdsMutex;
     std::shared_ptr<JobScheduler> mJobScheduler;
+    std::shared_ptr<ThreadPool> mQueryThreadPool, mProbeThreadPool, mVerifyThreadPool, mRestoreThreadPool;
     CompletionThread *mCompletionThread;
     Set<uint32_t> mActiveBuffers;
     Set<std::shared_ptr<Connection> > mConnections;
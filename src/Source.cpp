@@ -737,6 +737,9 @@ SourceList Source::parse(const String &cmdLine,
         includePathHash = ::hashIncludePaths(includePaths, buildRoot, serverFlags);
 
         ret.reserve(inputs.size());
+        const Interned<Set<Define> > sharedDefines(defines);
+        const Interned<List<Include> > sharedIncludePaths(includePaths);
+        const Interned<List<String> > sharedArguments(arguments);
         for (const auto input : inputs) {
             unresolvedInputLocations->append(input.absolute);
             if (input.unmolested == "-")
@@ -749,9 +752,9 @@ SourceList Source::parse(const String &cmdLine,
             source.buildRootId = buildRootId;
             source.includePathHash = includePathHash;
             source.flags = sourceFlags;
-            source.defines = defines;
-            source.includePaths = includePaths;
-            source.arguments = arguments;
+            source.defines = sharedDefines;
+            source.includePaths = sharedIncludePaths;
+            source.arguments = sharedArguments;
             source.outputFilename = outputFilename;
             source.language = input.language;
             assert(source.language != NoLanguage);
@@ -832,11 +835,16 @@ bool Source::compareArguments(const Source &other) const
             warning() << "defines are different 1";
             return false;
         }
-    } else if (!compareDefinesNoNDEBUG(defines, other.defines)) {
+    } else if (!defines.isSameBlock(other.defines) && !compareDefinesNoNDEBUG(defines, other.defines)) {
         warning() << "defines are different 2";
         return false;
     }
 
+    if (arguments.isSameBlock(other.arguments)) {
+        warning() << "Args are the same";
+        return true;
+    }
+
     auto me = arguments.begin();
     const auto myEnd = arguments.end();
     auto him = other.arguments.begin();
@@ -892,7 +900,7 @@ List<String> Source::toCommandLine(Flags<CommandLineFlag> f, bool *usedPch) cons
     }
 
     for (size_t i=0; i<arguments.size(); ++i) {
-        const String &arg = arguments.at(i);
+        const String &arg = arguments->at(i);
         const bool hasValue = ::hasValue(arg);
         bool skip = false;
         if (f & FilterBlacklist && isBlacklisted(arg)) {
@@ -903,7 +911,7 @@ List<String> Source::toCommandLine(Flags<CommandLineFlag> f, bool *usedPch) cons
         if (!skip) {
             ret.append(arg);
             if (hasValue)
-                ret.append(arguments.value(++i));
+                ret.append(arguments->value(++i));
         } else if (hasValue) {
             ++i;
         }
@@ -990,11 +998,11 @@ void Source::encode(Serializer &s, EncodeMode mode) const
           << compileCommands() << compileCommandsFileId
           << static_cast<uint8_t>(language) << flags << defines;
 
-        auto incPaths = includePaths;
+        List<Include> incPaths = includePaths;
         for (auto &inc : incPaths)
             Sandbox::encode(inc.path);
 
-        s << incPaths << Sandbox::encoded(arguments)
+        s << Interned<List<Include> >(incPaths) << Interned<List<String> >(Sandbox::encoded(arguments.get()))
           << Sandbox::encoded(directory) << includePathHash;
     } else {
         s << sourceFile() << fileId << compiler() << compilerId
@@ -1023,9 +1031,13 @@ void Source::decode(Deserializer &s, EncodeMode mode)
         Sandbox::decode(compiler);
         Sandbox::decode(extraCompiler);
         Sandbox::decode(directory);
-        for (auto &inc : includePaths)
+        List<Include> incPaths = includePaths;
+        for (auto &inc : incPaths)
             Sandbox::decode(inc.path);
-        Sandbox::decode(arguments);
+        includePaths = incPaths;
+        List<String> args = arguments;
+        Sandbox::decode(args);
+        arguments = args;
     }
 
     assert(fileId);
@@ -18,6 +18,7 @@
 
 #include <cstdint>
 
+#include "Interned.h"
 #include "Location.h"
 #include "rct/Flags.h"
 #include "rct/List.h"
@@ -99,7 +100,9 @@ struct Source
         }
     };
 
-    Set<Define> defines;
+    // defines, includePaths and arguments are mostly the same for every
+    // source in a target so they're shared, see Interned
+    Interned<Set<Define> > defines;
     struct Include {
         enum Type {
             Type_None
@@ -139,8 +142,8 @@ struct Source
         inline bool operator<(const Include &other) const { return compare(other) < 0; }
         inline bool operator>(const Include &other) const { return compare(other) > 0; }
     };
-    List<Include> includePaths;
-    List<String> arguments;
+    Interned<List<Include> > includePaths;
+    Interned<List<String> > arguments;
     // int32_t sysRootIndex;
     Path directory;
     Path outputFilename;
@@ -177,6 +180,14 @@ struct Source
     };
     void encode(Serializer &serializer, EncodeMode mode) const;
     void decode(Deserializer &deserializer, EncodeMode mode);
+
+    // Sources serialized while this exists write each shared block once
+    struct BlockTables
+    {
+        Interned<Set<Define> >::Table defines;
+        Interned<List<Include> >::Table includePaths;
+        Interned<List<String> >::Table arguments;
+    };
 };
 
 RCT_FLAGS(Source::Flag);
@@ -36,7 +36,7 @@ int StatusJob::execute()
         return !strncasecmp(query.constData(), name, query.size());
     };
     bool matched = false;
-    const char *alternatives = "fileids|watchedpaths|dependencies|cursors|symbols|targets|symbolnames|sources|jobs|info|compilers|headererrors|memory|project";
+    const char *alternatives = "fileids|watchedpaths|dependencies|cursors|symbols|targets|symbolnames|sources|jobs|info|compilers|headererrors|memory|bloomfilters|filemapcache|project";
 
     if (match("fileids")) {
         matched = true;
@@ -83,6 +83,14 @@ int StatusJob::execute()
             << "rpIndexDataMessageTimeout: " << opt.rpIndexDataMessageTimeout << '\n'
             << "rpConnectTimeout: " << opt.rpConnectTimeout << '\n'
             << "rpConnectTimeout: " << opt.rpConnectTimeout << '\n'
+            << "rpJobsPerProcess: " << opt.rpJobsPerProcess << '\n'
+            << "rpMaxMemory: " << opt.rpMaxMemory << '\n'
+            << "jobMemoryBudget: " << opt.jobMemoryBudget << '\n'
+            << "queryThreads: " << opt.queryThreads << '\n'
+            << "probeThreads: " << opt.probeThreads << '\n'
+            << "representativeSources: " << opt.representativeSources << '\n'
+            << "maxFileMapScopeCacheSize: " << opt.maxFileMapScopeCacheSize << '\n'
+            << "maxFileMapCacheMemory: " << opt.maxFileMapCacheMemory << '\n'
             << "defaultArguments: " << opt.defaultArguments << '\n'
             << "includePaths: " << opt.includePaths << '\n'
             << "defines: " << opt.defines << '\n'
@@ -176,11 +184,11 @@ int StatusJob::execute()
                 const String usr = targets->keyAt(i);
                 write<128>("  %s", usr.constData());
                 for (const auto &t : proj->findByUsr(usr, dep.first, Project::ArgDependsOn)) {
-                    write<1024>("      %s\t%s", t.location.toString(locationToStringFlags()).constData(),
+                    write<1024>("      %s\t%s", t.location.toString(locationToStringFlags(), 0, proj.get()).constData(),
                                 t.kindSpelling().constData());
                 }
                 for (const auto &location : targets->valueAt(i)) {
-                    write<1024>("    %s", location.toString(locationToStringFlags()).constData());
+                    write<1024>("    %s", location.toString(locationToStringFlags(), 0, proj.get()).constData());
                 }
                 write("------------------------");
                 if (isAborted())
@@ -246,10 +254,40 @@ int StatusJob::execute()
         matched = true;
     }
 
+    if (query.isEmpty() || match("bloomfilters")) {
+        if (!write(delimiter) || !write("bloomfilters") || !write(delimiter))
+            return 1;
+        const BloomFilterCache::Stats stats = proj->bloomFilterStats();
+        write<256>("Loaded: %zu (%zu bytes)\n"
+                   "Hits: %zu\n"
+                   "Skips: %zu\n"
+                   "Evictions: %zu",
+                   stats.count, stats.bytes, stats.probeHits, stats.probeSkips, stats.evictions);
+        matched = true;
+    }
+
+    if (query.isEmpty() || match("filemapcache")) {
+        if (!write(delimiter) || !write("filemapcache") || !write(delimiter))
+            return 1;
+        if (std::shared_ptr<FileMapCache> cache = proj->fileMapCache()) {
+            const FileMapCache::Stats stats = cache->stats();
+            write<256>("Mapped: %zu (%zu bytes)\n"
+                       "Hits: %zu\n"
+                       "Misses: %zu\n"
+                       "Evictions: %zu\n"
+                       "Invalidations: %zu",
+                       stats.count, stats.bytes, stats.hits, stats.misses, stats.evictions, stats.invalidations);
+        } else {
+            write("Disabled");
+        }
+        matched = true;
+    }
+
     if (query.isEmpty() || match("project")) {
         if (!write(delimiter) || !write("project") || !write(delimiter))
             return 1;
         write(String::format<1024>("Path: %s", proj->path().constData()));
+        write(String::format<32>("Restored: %s", proj->isRestored() ? "yes" : "no"));
         bool first = true;
         for (const auto &info : proj->indexParseData().compileCommands) {
             if (first) {
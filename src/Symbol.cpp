@@ -102,7 +102,7 @@ String Symbol::toString(const std::shared_ptr<Project> &project,
                 if (!symName.isEmpty()) {
                     args << symName;
                 } else {
-                    args << arg.cursor.toString(locationToStringFlags & ~Location::ShowContext);
+                    args << arg.cursor.toString(locationToStringFlags & ~Location::ShowContext, 0, project.get());
                 }
             }
         }
@@ -120,7 +120,7 @@ String Symbol::toString(const std::shared_ptr<Project> &project,
             ret << key << ": ";
         ret << piece << "\n";
     };
-    writePiece(0, "location", location.toString(locationToStringFlags));
+    writePiece(0, "location", location.toString(locationToStringFlags, 0, project.get()));
     writePiece("SymbolName", "symbolname", symbolName);
     writePiece("Kind", "kind", kindSpelling());
     if (filterPiece("type")) {
@@ -180,11 +180,11 @@ String Symbol::toString(const std::shared_ptr<Project> &project,
                 && comparePosition(line, column, s.startLine, s.startColumn) >= 0
                 && comparePosition(line, column, s.endLine, s.endColumn) <= 0) {
                 if (cursorInfoFlags & IncludeContainingFunctionLocation)
-                    writePiece("Containing function location", "cfl", s.location.toString(locationToStringFlags));
+                    writePiece("Containing function location", "cfl", s.location.toString(locationToStringFlags, 0, project.get()));
                 if (cursorInfoFlags & IncludeContainingFunction)
                     writePiece("Containing function", "cf", s.symbolName);
                 if (cursorInfoFlags & IncludeParents)
-                    writePiece("Parent", "parent", s.location.toString(locationToStringFlags)); // redundant, this is a mess
+                    writePiece("Parent", "parent", s.location.toString(locationToStringFlags, 0, project.get())); // redundant, this is a mess
                 break;
             }
         }
@@ -197,11 +197,11 @@ String Symbol::toString(const std::shared_ptr<Project> &project,
         if (targets.size()) {
             ret.append("Targets:\n");
             auto best = RTags::bestTarget(targets);
-            ret.append(String::format<128>("    %s\n", best.location.toString(locationToStringFlags).constData()));
+            ret.append(String::format<128>("    %s\n", best.location.toString(locationToStringFlags, 0, project.get()).constData()));
 
             for (const auto &tit : targets) {
                 if (tit.location != best.location)
-                    ret.append(String::format<128>("    %s\n", tit.location.toString(locationToStringFlags).constData()));
+                    ret.append(String::format<128>("    %s\n", tit.location.toString(locationToStringFlags, 0, project.get()).constData()));
             }
         }
     }
@@ -211,7 +211,7 @@ String Symbol::toString(const std::shared_ptr<Project> &project,
         if (references.size()) {
             ret.append("References:\n");
             for (const auto &r : references) {
-                ret.append(String::format<128>("    %s\n", r.location.toString(locationToStringFlags).constData()));
+                ret.append(String::format<128>("    %s\n", r.location.toString(locationToStringFlags, 0, project.get()).constData()));
             }
         }
     }
@@ -269,16 +269,16 @@ Value Symbol::toValue(const std::shared_ptr<Project> &project,
     auto filterPiece = [&pieceFilters](const char *name) { return pieceFilters.isEmpty() || pieceFilters.contains(name); };
     std::function<Value(const Symbol &, Flags<ToStringFlag>)> toValue = [&](const Symbol &symbol, Flags<ToStringFlag> f) {
         Value ret;
-        auto formatLocation = [locationToStringFlags,&filterPiece, &ret](const Location &loc, const char *key, const char *ctxKey,
-                                                                         const char *keyFilter = 0,
-                                                                         const char *ctxKeyFilter = 0,
-                                                                         Value *val = 0) {
+        auto formatLocation = [locationToStringFlags, &project, &filterPiece, &ret](const Location &loc, const char *key, const char *ctxKey,
+                                                                                   const char *keyFilter = 0,
+                                                                                   const char *ctxKeyFilter = 0,
+                                                                                   Value *val = 0) {
             if (!val)
                 val = &ret;
             if (filterPiece(keyFilter ? keyFilter : key))
-                (*val)[key] = loc.toString(locationToStringFlags & ~Location::ShowContext);
+                (*val)[key] = loc.toString(locationToStringFlags & ~Location::ShowContext, 0, project.get());
             if (locationToStringFlags & Location::ShowContext && filterPiece(ctxKeyFilter ? ctxKeyFilter : ctxKey)) {
-                (*val)[ctxKey] = loc.context(locationToStringFlags);
+                (*val)[ctxKey] = loc.context(locationToStringFlags, 0, project.get());
             }
         };
         if (!symbol.isNull()) {
@@ -286,11 +286,11 @@ Value Symbol::toValue(const std::shared_ptr<Project> &project,
             if (symbol.argumentUsage.index != String::npos) {
                 formatLocation(symbol.argumentUsage.invocation, "invocation", "invocationContext", 0, "invocationcontext");
                 if (filterPiece("invokedfunction"))
-                    ret["invokedFunction"] = symbol.argumentUsage.invokedFunction.toString(locationToStringFlags);
+                    ret["invokedFunction"] = symbol.argumentUsage.invokedFunction.toString(locationToStringFlags, 0, project.get());
                 formatLocation(symbol.argumentUsage.argument.location, "functionArgumentLocation", "functionArgumentLocationContext",
                                "functionargumentlocation", "functionargumentlocationcontext");
                 if (filterPiece("functionargumentcursor"))
-                    ret["functionArgumentCursor"] = symbol.argumentUsage.argument.cursor.toString(locationToStringFlags);
+                    ret["functionArgumentCursor"] = symbol.argumentUsage.argument.cursor.toString(locationToStringFlags, 0, project.get());
                 if (filterPiece("functionargumentlength"))
                     ret["functionArgumentLength"] = symbol.argumentUsage.argument.length;
                 if (filterPiece("argumentindex"))
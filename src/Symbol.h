@@ -20,6 +20,7 @@
 #include <memory>
 #include <stdint.h>
 
+#include "FileMap.h"
 #include "Location.h"
 #include "Sandbox.h"
 #include "rct/Flags.h"
@@ -247,6 +248,76 @@ template <> inline Deserializer &operator>>(Deserializer &s, Symbol &t)
     return s;
 }
 
+// Lazily decodes fields of a Symbol serialized in a FileMap without
+// deserializing the whole thing. Strings are returned as stored, i.e. still
+// Sandbox encoded. Must match operator<<(Serializer &, const Symbol &).
+class SymbolView
+{
+public:
+    SymbolView()
+        : mData(0)
+    {}
+    explicit SymbolView(const char *pointer)
+        : mData(pointer)
+    {}
+
+    Location location() const
+    {
+        Location loc;
+        memcpy(&loc, mData, sizeof(uint64_t));
+        return loc;
+    }
+    StringView symbolName() const { return StringView(symbolNamePointer()); }
+    StringView usr() const { return StringView(skipString(symbolNamePointer())); }
+    CXCursorKind kind() const
+    {
+        uint16_t kind;
+        memcpy(&kind, symbolLengthPointer() + sizeof(uint16_t), sizeof(kind));
+        return static_cast<CXCursorKind>(kind);
+    }
+    uint16_t flags() const
+    {
+        uint16_t flags;
+        memcpy(&flags, symbolLengthPointer() + (sizeof(uint16_t) * 3) + sizeof(uint8_t), sizeof(flags));
+        return flags;
+    }
+    bool isDefinition() const { return flags() & Symbol::Definition; }
+private:
+    enum {
+        ArgumentSize = (sizeof(uint64_t) * 2) + sizeof(size_t),
+        ArgumentUsageSize = (sizeof(uint64_t) * 2) + ArgumentSize
+    };
+    static const char *skipString(const char *pointer)
+    {
+        uint32_t size;
+        memcpy(&size, pointer, sizeof(size));
+        return pointer + sizeof(size) + size;
+    }
+    const char *symbolNamePointer() const
+    {
+        const char *pointer = mData + sizeof(uint64_t);
+        size_t index;
+        memcpy(&index, pointer, sizeof(index));
+        pointer += sizeof(index);
+        if (index != String::npos)
+            pointer += ArgumentUsageSize;
+        return pointer;
+    }
+    const char *symbolLengthPointer() const
+    {
+        const char *pointer = skipString(skipString(skipString(symbolNamePointer()))); // symbolName, usr, typeName
+        uint32_t count;
+        memcpy(&count, pointer, sizeof(count));
+        pointer += sizeof(count);
+        for (uint32_t i=0; i<count; ++i) // baseClasses
+            pointer = skipString(pointer);
+        memcpy(&count, pointer, sizeof(count));
+        return pointer + sizeof(count) + (count * ArgumentSize); // arguments
+    }
+
+    const char *mData;
+};
+
 static inline Log operator<<(Log dbg, const Symbol &symbol)
 {
     const String out = "Symbol(" + symbol.toString() + ")";
@@ -17,24 +17,29 @@
 #define VisitFileMessage_h
 
 #include "RTagsMessage.h"
+#include "rct/List.h"
+#include "rct/Path.h"
 
 class VisitFileMessage : public RTagsMessage
 {
 public:
     enum { MessageId = VisitFileId };
 
-    VisitFileMessage(const Path &file = Path(), const Path &project = Path(), uint32_t sourceFileId = 0)
-        : RTagsMessage(MessageId), mFile(file), mProject(project), mSourceFileId(sourceFileId)
+    // rp usually asks for all the files a translation unit includes in one
+    // message, see ClangIndexer::resolveInclusions()
+    VisitFileMessage(const List<Path> &files = List<Path>(), const Path &project = Path(), uint32_t sourceFileId = 0)
+        : RTagsMessage(MessageId), mFiles(files), mProject(project), mSourceFileId(sourceFileId)
     {
     }
 
     Path project() const { return mProject; }
-    Path file() const { return mFile; }
+    const List<Path> &files() const { return mFiles; }
     uint32_t sourceFileId() const { return mSourceFileId; }
-    void encode(Serializer &serializer) const { serializer << mProject << mFile << mSourceFileId; }
-    void decode(Deserializer &deserializer) { deserializer >> mProject >> mFile >> mSourceFileId; }
+    void encode(Serializer &serializer) const { serializer << mProject << mFiles << mSourceFileId; }
+    void decode(Deserializer &deserializer) { deserializer >> mProject >> mFiles >> mSourceFileId; }
 private:
-    Path mFile, mProject;
+    List<Path> mFiles;
+    Path mProject;
     uint32_t mSourceFileId;
 };
 
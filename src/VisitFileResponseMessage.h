@@ -17,25 +17,29 @@
 #define VisitFileResponseMessage_h
 
 #include "RTagsMessage.h"
+#include "rct/List.h"
+#include "rct/Set.h"
 
 class VisitFileResponseMessage : public RTagsMessage
 {
 public:
     enum { MessageId = VisitFileResponseId };
 
-    VisitFileResponseMessage(uint32_t fileId = 0, bool visit = false)
-        : RTagsMessage(MessageId), mFileId(fileId), mVisit(visit)
+    // fileIds are in the same order as VisitFileMessage::files(), 0 means
+    // that the job is no longer active
+    VisitFileResponseMessage(const List<uint32_t> &fileIds = List<uint32_t>(), const Set<uint32_t> &visit = Set<uint32_t>())
+        : RTagsMessage(MessageId), mFileIds(fileIds), mVisit(visit)
     {
     }
 
-    uint32_t fileId() const { return mFileId; }
-    bool visit() const { return mVisit; }
+    const List<uint32_t> &fileIds() const { return mFileIds; }
+    bool visit(uint32_t fileId) const { return mVisit.contains(fileId); }
 
-    void encode(Serializer &serializer) const { serializer << mFileId << mVisit; }
-    void decode(Deserializer &deserializer) { deserializer >> mFileId >> mVisit; }
+    void encode(Serializer &serializer) const { serializer << mFileIds << mVisit; }
+    void decode(Deserializer &deserializer) { deserializer >> mFileIds >> mVisit; }
 private:
-    uint32_t mFileId;
-    bool mVisit;
+    List<uint32_t> mFileIds;
+    Set<uint32_t> mVisit;
 };
 
 #endif
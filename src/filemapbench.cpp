@@ -0,0 +1,138 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Compares FileMap lookups with and without FileMap::PrefixIndex. Both
+// layouts have to give the same index as a plain binary search over the
+// sorted keys before anything is timed.
+// Usage: filemapbench [keys] [lookups]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "FileMap.h"
+#include "rct/StopWatch.h"
+
+typedef FileMap<String, Set<Location> > SymbolNameMap;
+
+static String randomKey()
+{
+    static const char *prefixes[] = { "", "std::", "rtags::", "c:@N@std@S@", "c:@N@llvm@" };
+    String key = prefixes[rand() % (sizeof(prefixes) / sizeof(prefixes[0]))];
+    const int len = 6 + (rand() % 24);
+    for (int i=0; i<len; ++i)
+        key += static_cast<char>('a' + (rand() % 26));
+    return key;
+}
+
+// returns false and prints the first key where a layout disagrees with a
+// plain binary search over keys
+static bool verify(const List<String> &keys, const String &binary, const String &prefix, const List<String> &lookups)
+{
+    SymbolNameMap binaryMap, prefixMap;
+    binaryMap.init(binary.constData(), binary.size());
+    prefixMap.init(prefix.constData(), prefix.size());
+    for (const String &key : lookups) {
+        const auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        const uint32_t expected = static_cast<uint32_t>(it - keys.begin());
+        const bool expectedMatch = it != keys.end() && *it == key;
+        bool binaryMatch, prefixMatch;
+        const uint32_t binaryIndex = binaryMap.lowerBound(key, &binaryMatch);
+        const uint32_t prefixIndex = prefixMap.lowerBound(key, &prefixMatch);
+        if (binaryIndex != expected || prefixIndex != expected
+            || binaryMatch != expectedMatch || prefixMatch != expectedMatch) {
+            fprintf(stderr, "Mismatch for \"%s\": expected %u (%d) binary %u (%d) prefix %u (%d)\n",
+                    key.constData(), expected, expectedMatch, binaryIndex, binaryMatch, prefixIndex, prefixMatch);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bench(const char *name, const String &data, const List<String> &lookups)
+{
+    SymbolNameMap map;
+    map.init(data.constData(), data.size());
+    size_t found = 0;
+    StopWatch sw;
+    for (const String &key : lookups) {
+        bool match;
+        map.lowerBound(key, &match);
+        found += match;
+    }
+    const uint64_t elapsed = sw.elapsed();
+    printf("%-10s %8zu bytes %6llums %8.1fns/lookup (%zu found)\n",
+           name, data.size(), static_cast<unsigned long long>(elapsed),
+           (elapsed * 1000000.0) / std::max<size_t>(lookups.size(), 1), found);
+}
+
+int main(int argc, char **argv)
+{
+    const int keyCount = argc > 1 ? atoi(argv[1]) : 500000;
+    const int lookupCount = argc > 2 ? atoi(argv[2]) : 2000000;
+    srand(0);
+
+    Map<String, Set<Location> > map;
+    List<String> keys;
+    while (static_cast<int>(map.size()) < keyCount) {
+        const String key = randomKey();
+        if (!map.contains(key)) {
+            map[key];
+            keys.append(key);
+        }
+    }
+
+    // Runs of keys that share their first 8 bytes, the prefix index can't
+    // tell them apart so the search has to fall back to the full keys. The
+    // misses land before, inside and after each run and on the bare prefix.
+    static const char *runs[] = { "c:@N@std", "abcdefgh", "zzzzzzzz" };
+    List<String> checks;
+    for (const char *run : runs) {
+        const String start = run;
+        for (int i=0; i<64; ++i) {
+            const String key = start + String::number(i * 2);
+            map[key];
+            checks.append(key);
+            checks.append(start + String::number((i * 2) + 1));
+        }
+        checks.append(start);
+        checks.append(start.mid(0, 7));
+        checks.append(start + "~");
+    }
+    checks.append(String());
+    checks.append("\x01");
+    checks.append("~~~~~~~~~~");
+
+    List<String> sorted;
+    sorted.reserve(map.size());
+    for (const auto &it : map)
+        sorted.append(it.first);
+    const String binary = SymbolNameMap::encode(map);
+    const String prefix = SymbolNameMap::encode(map, SymbolNameMap::PrefixIndex);
+
+    List<String> lookups;
+    lookups.reserve(lookupCount);
+    for (int i=0; i<lookupCount; ++i)
+        lookups.append(i % 2 ? keys.at(rand() % keys.size()) : randomKey());
+
+    checks.insert(checks.end(), sorted.begin(), sorted.end());
+    checks.insert(checks.end(), lookups.begin(), lookups.end());
+    if (!verify(sorted, binary, prefix, checks))
+        return 1;
+
+    bench("binary", binary, lookups);
+    bench("prefix", prefix, lookups);
+    return 0;
+}
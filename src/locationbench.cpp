@@ -0,0 +1,95 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Compares Location::path() with a mutex protected Hash lookup (which is
+// what Location::path() used to do) while another thread keeps adding
+// files.
+// Usage: locationbench [threads] [lookups per thread]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Location.h"
+#include "rct/Hash.h"
+#include "rct/StopWatch.h"
+
+enum {
+    FileCount = 100000,
+    MaxFileId = 1 << 22
+};
+
+static void bench(const char *name, int threadCount, int lookups,
+                  std::function<size_t(uint32_t)> lookup,
+                  std::function<void(uint32_t, const Path &)> insert)
+{
+    std::atomic<bool> done(false);
+    std::thread writer([&done, &insert]() {
+            for (uint32_t id = FileCount + 1; !done && id < MaxFileId; ++id)
+                insert(id, String::format<64>("/tmp/locationbench/new/%u.h", id));
+        });
+    std::vector<std::thread> readers;
+    std::atomic<size_t> total(0);
+    StopWatch sw;
+    for (int t=0; t<threadCount; ++t) {
+        readers.push_back(std::thread([&total, &lookup, lookups, t]() {
+                    size_t bytes = 0;
+                    uint32_t id = t;
+                    for (int i=0; i<lookups; ++i) {
+                        id = (id * 1103515245 + 12345) % FileCount;
+                        bytes += lookup(id + 1);
+                    }
+                    total += bytes;
+                }));
+    }
+    for (auto &reader : readers)
+        reader.join();
+    const uint64_t elapsed = sw.elapsed();
+    done = true;
+    writer.join();
+    printf("%-7s %2d threads %6llums %8.1fns/lookup (%zu bytes)\n",
+           name, threadCount, static_cast<unsigned long long>(elapsed),
+           (elapsed * 1000000.0) / std::max(1, threadCount * lookups), static_cast<size_t>(total));
+}
+
+int main(int argc, char **argv)
+{
+    const int threadCount = argc > 1 ? atoi(argv[1]) : 8;
+    const int lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    Hash<uint32_t, Path> paths;
+    for (uint32_t i=1; i<=FileCount; ++i)
+        paths[i] = String::format<64>("/tmp/locationbench/%u.h", i);
+    Location::init(paths);
+
+    std::mutex mutex;
+    bench("locked", threadCount, lookups, [&mutex, &paths](uint32_t id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return paths.value(id).size();
+        }, [&mutex, &paths](uint32_t id, const Path &path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            paths[id] = path;
+        });
+    bench("atomic", threadCount, lookups, [](uint32_t id) {
+            return Location::path(id).size();
+        }, [](uint32_t id, const Path &path) {
+            Location::set(path, id);
+        });
+    return 0;
+}
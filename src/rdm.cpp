@@ -79,9 +79,15 @@ static void signalHandler(int signal)
 #define DEFAULT_COMPILER_WRAPPERS "ccache"
 #define DEFAULT_RP_VISITFILE_TIMEOUT 60000
 #define DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE 500
+#define DEFAULT_RDM_MAX_FILE_MAP_CACHE_MEMORY 256 // MB
+#define DEFAULT_QUERY_THREADS 0 // run queries on the main thread
+#define DEFAULT_REPRESENTATIVE_SOURCES 0 // reindex all dependents right away
 #define DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT 60000
 #define DEFAULT_RP_CONNECT_TIMEOUT 0 // won't time out
 #define DEFAULT_RP_CONNECT_ATTEMPTS 3
+#define DEFAULT_RP_JOBS_PER_PROCESS 1
+#define DEFAULT_RP_MAX_MEMORY 0 // no limit
+#define DEFAULT_JOB_MEMORY_BUDGET 0 // no limit
 #define DEFAULT_COMPLETION_CACHE_SIZE 10
 #define DEFAULT_ERROR_LIMIT 50
 #define DEFAULT_MAX_INCLUDE_COMPLETION_DEPTH 3
@@ -162,6 +168,8 @@ enum OptionType {
     RpConnectTimeout,
     RpConnectAttempts,
     RpNiceValue,
+    RpJobsPerProcess,
+    RpMaxMemory,
     SuspendRpOnCrash,
     RpLogToSyslog,
     StartSuspended,
@@ -179,6 +187,11 @@ enum OptionType {
     EnableNDEBUG,
     Progress,
     MaxFileMapCacheSize,
+    MaxFileMapCacheMemory,
+    QueryThreads,
+    ProbeThreads,
+    RepresentativeSources,
+    JobMemoryBudget,
 #ifdef FILEMANAGER_OPT_IN
     FileManagerWatch,
 #else
@@ -238,7 +251,14 @@ int main(int argc, char** argv)
     serverOpts.rpIndexDataMessageTimeout = DEFAULT_RP_INDEXER_MESSAGE_TIMEOUT;
     serverOpts.rpConnectTimeout = DEFAULT_RP_CONNECT_TIMEOUT;
     serverOpts.rpConnectAttempts = DEFAULT_RP_CONNECT_ATTEMPTS;
+    serverOpts.rpJobsPerProcess = DEFAULT_RP_JOBS_PER_PROCESS;
+    serverOpts.rpMaxMemory = DEFAULT_RP_MAX_MEMORY;
     serverOpts.maxFileMapScopeCacheSize = DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE;
+    serverOpts.maxFileMapCacheMemory = DEFAULT_RDM_MAX_FILE_MAP_CACHE_MEMORY;
+    serverOpts.queryThreads = DEFAULT_QUERY_THREADS;
+    serverOpts.probeThreads = ThreadPool::idealThreadCount();
+    serverOpts.representativeSources = DEFAULT_REPRESENTATIVE_SOURCES;
+    serverOpts.jobMemoryBudget = DEFAULT_JOB_MEMORY_BUDGET;
     serverOpts.errorLimit = DEFAULT_ERROR_LIMIT;
     serverOpts.rpNiceValue = INT_MIN;
     serverOpts.options = Server::Wall|Server::SpellChecking;
@@ -309,6 +329,8 @@ int main(int argc, char** argv)
         { RpConnectTimeout, "rp-connect-timeout", 'O', CommandLineParser::Required, "Timeout for connection from rp to rdm in ms (0 means no timeout) (default " STR(DEFAULT_RP_CONNECT_TIMEOUT) ")." },
         { RpConnectAttempts, "rp-connect-attempts", 0, CommandLineParser::Required, "Number of times rp attempts to connect to rdm before giving up. (default " STR(DEFAULT_RP_CONNECT_ATTEMPTS) ")." },
         { RpNiceValue, "rp-nice-value", 'a', CommandLineParser::Required, "Nice value to use for rp (nice(2)) (default is no nicing)." },
+        { RpJobsPerProcess, "rp-jobs-per-process", 0, CommandLineParser::Required, "Number of jobs an rp process handles before it is restarted. Values > 1 keep rp processes alive between jobs (default " STR(DEFAULT_RP_JOBS_PER_PROCESS) ")." },
+        { RpMaxMemory, "rp-max-memory", 0, CommandLineParser::Required, "Restart persistent rp processes that use more than this many megabytes of memory (0 means no limit) (default " STR(DEFAULT_RP_MAX_MEMORY) ")." },
         { SuspendRpOnCrash, "suspend-rp-on-crash", 'q', CommandLineParser::NoValue, "Suspend rp in SIGSEGV handler (default " DEFAULT_SUSPEND_RP ")." },
         { RpLogToSyslog, "rp-log-to-syslog", 0, CommandLineParser::NoValue, "Make rp log to syslog." },
         { StartSuspended, "start-suspended", 'Q', CommandLineParser::NoValue, "Start out suspended (no reindexing enabled)." },
@@ -326,6 +348,11 @@ int main(int argc, char** argv)
         { EnableNDEBUG, "enable-NDEBUG", 'g', CommandLineParser::NoValue, "Don't remove -DNDEBUG from compile lines." },
         { Progress, "progress", 'p', CommandLineParser::NoValue, "Report compilation progress in diagnostics output." },
         { MaxFileMapCacheSize, "max-file-map-cache-size", 'y', CommandLineParser::Required, "Max files to cache per query (Should not exceed maximum number of open file descriptors allowed per process) (default " STR(DEFAULT_RDM_MAX_FILE_MAP_CACHE_SIZE) ")." },
+        { MaxFileMapCacheMemory, "max-file-map-cache-memory", 0, CommandLineParser::Required, "Max megabytes of files to keep mapped between queries, at most max-file-map-cache-size files are kept. 0 disables (default " STR(DEFAULT_RDM_MAX_FILE_MAP_CACHE_MEMORY) ")." },
+        { QueryThreads, "query-threads", 0, CommandLineParser::Required, "Number of threads used to run read-only queries against a snapshot of the project. 0 runs them on the main thread (default " STR(DEFAULT_QUERY_THREADS) ")." },
+        { ProbeThreads, "probe-threads", 0, CommandLineParser::Required, "Number of threads used to search files in parallel for references, subclasses and usrs. 0 or 1 searches on the querying thread (default number of cores)." },
+        { RepresentativeSources, "representative-sources", 0, CommandLineParser::Required, "When a file is modified reindex this many of the sources depending on it first and the rest at low priority. 0 reindexes all of them right away (default " STR(DEFAULT_REPRESENTATIVE_SOURCES) ")." },
+        { JobMemoryBudget, "job-memory-budget", 0, CommandLineParser::Required, "Don't start more jobs when the rp processes are using or expected to use more than this many megabytes. 0 means no limit (default " STR(DEFAULT_JOB_MEMORY_BUDGET) ")." },
 #ifdef FILEMANAGER_OPT_IN
         { FileManagerWatch, "filemanager-watch", 'M', CommandLineParser::NoValue, "Use a file system watcher for filemanager." },
 #else
@@ -536,6 +563,19 @@ int main(int argc, char** argv)
                 return { String::format<1024>("Can't parse argument to -a %s.", value.constData()), CommandLineParser::Parse_Error };
             }
             break; }
+        case RpJobsPerProcess: {
+            serverOpts.rpJobsPerProcess = atoi(value.constData());
+            if (serverOpts.rpJobsPerProcess <= 0) {
+                return { String::format<1024>("Invalid argument to --rp-jobs-per-process %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case RpMaxMemory: {
+            bool ok;
+            serverOpts.rpMaxMemory = value.toLong(&ok);
+            if (!ok || serverOpts.rpMaxMemory < 0) {
+                return { String::format<1024>("Invalid argument to --rp-max-memory %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
         case SuspendRpOnCrash: {
             serverOpts.options |= Server::SuspendRPOnCrash;
             break; }
@@ -596,6 +636,41 @@ int main(int argc, char** argv)
                 return { String::format<1024>("Invalid argument to -y %s", value.constData()), CommandLineParser::Parse_Error };
             }
             break; }
+        case MaxFileMapCacheMemory: {
+            bool ok;
+            serverOpts.maxFileMapCacheMemory = value.toLong(&ok);
+            if (!ok || serverOpts.maxFileMapCacheMemory < 0) {
+                return { String::format<1024>("Invalid argument to --max-file-map-cache-memory %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case QueryThreads: {
+            bool ok;
+            serverOpts.queryThreads = value.toLong(&ok);
+            if (!ok || serverOpts.queryThreads < 0) {
+                return { String::format<1024>("Invalid argument to --query-threads %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case ProbeThreads: {
+            bool ok;
+            serverOpts.probeThreads = value.toLong(&ok);
+            if (!ok || serverOpts.probeThreads < 0) {
+                return { String::format<1024>("Invalid argument to --probe-threads %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case RepresentativeSources: {
+            bool ok;
+            serverOpts.representativeSources = value.toLong(&ok);
+            if (!ok || serverOpts.representativeSources < 0) {
+                return { String::format<1024>("Invalid argument to --representative-sources %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case JobMemoryBudget: {
+            bool ok;
+            serverOpts.jobMemoryBudget = value.toLong(&ok);
+            if (!ok || serverOpts.jobMemoryBudget < 0) {
+                return { String::format<1024>("Invalid argument to --job-memory-budget %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
 #ifdef FILEMANAGER_OPT_IN
         case FileManagerWatch: {
             serverOpts.options &= ~Server::NoFileManagerWatch;
@@ -60,12 +60,15 @@ int main(int argc, char **argv)
 {
     LogLevel logLevel = LogLevel::Error;
     Path file;
+    bool persistent = false;
 
     for (int i=1; i<argc; ++i) {
         if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
             ++logLevel;
         } else if (!strcmp(argv[i], "--priority")) { // ignore, only for wrapping purposes
             ++i;
+        } else if (!strcmp(argv[i], "--persistent")) {
+            persistent = true;
         } else {
             file = argv[i];
         }
@@ -92,9 +95,22 @@ int main(int argc, char **argv)
 
     if (!file.isEmpty()) {
         data = file.readAll();
-    } else {
+        ClangIndexer indexer;
+        if (!indexer.exec(data)) {
+            error() << "ClangIndexer error";
+            return 3;
+        }
+        return 0;
+    }
+
+    // In persistent mode rdm keeps writing jobs to our stdin and closes it
+    // when it wants us gone.
+    int jobs = 0;
+    do {
         uint32_t size;
         if (!fread(&size, sizeof(size), 1, stdin)) {
+            if (jobs && feof(stdin))
+                break;
             error() << "Failed to read from stdin";
             return 1;
         }
@@ -106,12 +122,13 @@ int main(int argc, char **argv)
         // FILE *f = fopen("/tmp/data", "w");
         // fwrite(data.constData(), data.size(), 1, f);
         // fclose(f);
-    }
-    ClangIndexer indexer;
-    if (!indexer.exec(data)) {
-        error() << "ClangIndexer error";
-        return 3;
-    }
+        ClangIndexer indexer;
+        if (!indexer.exec(data)) {
+            error() << "ClangIndexer error";
+            return 3;
+        }
+        ++jobs;
+    } while (persistent);
 
     return 0;
 }